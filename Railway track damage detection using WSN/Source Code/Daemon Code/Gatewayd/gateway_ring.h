@@ -0,0 +1,336 @@
+/*
+   Wireless Sensor Networks Laboratory
+
+   Technische Universität München
+   Lehrstuhl für Kommunikationsnetze
+   http://www.lkn.ei.tum.de
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, version 2.0 of the License.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+   GATEWAY DAEMON: Shared-memory event ring
+*/
+
+#ifndef GATEWAY_RING_H_
+#define GATEWAY_RING_H_
+
+/*
+   Layout of the event ring published by gatewayd and the helpers used by its readers.
+   Shared between the daemon (C) and the Qt GUI (C++), so everything here is header-only.
+
+   There is one writer (the daemon) and any number of readers. Every slot carries the
+   sequence number of the event stored in it and works as a seqlock: the writer clears
+   it, fills the event, then publishes the new number. A reader looks at the event in
+   place and checks afterwards that the number did not change. A slow reader is simply
+   overtaken and skips ahead, the writer never waits for anybody.
+*/
+
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define GATEWAY_RING_SHM_NAME	"/railway_gatewayd"				/* shm_open() name of the ring */
+#define GATEWAY_RING_SOCKET		"/tmp/railway_gatewayd.sock"	/* Readers are woken up through this socket */
+#define GATEWAY_RING_MAGIC		0x44475752u						/* "RWGD" */
+#define GATEWAY_RING_VERSION	3
+#define GATEWAY_RING_SLOTS		1024							/* Must be a power of two */
+#define GATEWAY_EVENT_TEXT		112								/* Longer gateway lines are truncated */
+#define GATEWAY_EVENT_SAMPLES	16								/* Waveform samples per "Waveform Data" line */
+#define GATEWAY_CAPTURE_PREFIX	"Capture Source ID = "			/* Command readers send on the socket, passed on to the first gateway */
+
+/*--------------------------------------------------------------------------------_*/
+
+/*! What a gateway line means, decoded once by the daemon */
+typedef enum
+{
+	GATEWAY_EVENT_LINE = 0,			/* Any other line, only the text is useful */
+	GATEWAY_EVENT_TRACK_CLEAR,		/* "Clearing Track ID Status" */
+	GATEWAY_EVENT_TRAIN_ARRIVAL,	/* "Train Arrival Detected = <value>" */
+	GATEWAY_EVENT_FAULTED_TRACK,	/* "Faulted Track ID = <track>" */
+	GATEWAY_EVENT_SECTION_HEALTH,	/* "Track ID = <track>   Health Status = ...   Confidence = <value>" */
+	GATEWAY_EVENT_LATENCY,			/* "Latency Source ID = <track>   Hops = <value>   Origin = ..   Relay = ..   Batch = .." */
+	GATEWAY_EVENT_REPORT,			/* "Report Source ID = <track>", first report of a mote in the current window */
+	GATEWAY_EVENT_WAVEFORM_START,	/* "Waveform Source ID = <track>   Samples = <value>" */
+	GATEWAY_EVENT_WAVEFORM_DATA,	/* "Waveform Data = <s0> <s1> ...", value is the number of samples */
+	GATEWAY_EVENT_WAVEFORM_END,		/* "Waveform Complete Source ID = <track>   Transfer = .." (value 1) or "Waveform Failed ..." (value 0) */
+	GATEWAY_EVENT_WAVEFORM_REQUEST	/* "Waveform Requested Source ID = <track>   Transfer = <value>" */
+}gateway_event_kind_t;
+
+typedef struct
+{
+	uint64_t	rx_time_ns;					/* CLOCK_MONOTONIC when the daemon received the end of the line */
+	uint8_t		port;						/* Index of the gateway serial port on the daemon command line */
+	uint8_t		kind;						/* gateway_event_kind_t */
+	int16_t		track;
+	int32_t		value;
+	int32_t		stage[3];					/* Origin, relay and batch delay in ms of a latency report */
+	uint16_t	samples[GATEWAY_EVENT_SAMPLES];	/* Raw ADC values of a waveform data line */
+	char		text[GATEWAY_EVENT_TEXT];	/* Original line, NUL terminated */
+}gateway_event_t;
+
+typedef struct
+{
+	uint64_t		seq;					/* Sequence number of the stored event, 0 while it is being written */
+	gateway_event_t	event;
+}gateway_slot_t;
+
+typedef struct
+{
+	uint32_t		magic;
+	uint32_t		version;
+	uint32_t		slots;
+	uint32_t		event_size;
+	uint64_t		head;					/* Sequence number of the last published event, the first one is 1 */
+	gateway_slot_t	slot[GATEWAY_RING_SLOTS];
+}gateway_ring_t;
+
+/*! Per-reader cursor, lives in the reader's own memory */
+typedef struct
+{
+	const gateway_ring_t	*ring;
+	uint64_t				next;			/* Sequence number the reader expects next */
+	uint64_t				overruns;		/* Events lost because the writer overtook the reader */
+	int						socket;			/* Notification socket, -1 when not connected */
+}gateway_ring_reader_t;
+
+/*-------------------------------EVENT DECODING-----------------------------------_*/
+/*--------------------------------------------------------------------------------_*/
+
+/* Returns the integer following "<key> = " in line, or fallback if the key is missing */
+static inline long gateway_line_value(const char *line, const char *key, long fallback)
+{
+	const char *p = strstr(line, key);
+	if(p == NULL)
+		return fallback;
+
+	p = strchr(p + strlen(key), '=');
+	return (p == NULL) ? fallback : strtol(p + 1, NULL, 10);
+}
+
+/* Fills kind, track, value and text of ev from one gateway output line */
+static inline void gateway_event_decode(const char *line, gateway_event_t *ev)
+{
+	size_t len = strlen(line);
+	if(len >= GATEWAY_EVENT_TEXT)
+		len = GATEWAY_EVENT_TEXT - 1;
+	memcpy(ev->text, line, len);
+	ev->text[len] = '\0';
+
+	ev->kind  = GATEWAY_EVENT_LINE;
+	ev->track = 0;
+	ev->value = 0;
+	ev->stage[0] = ev->stage[1] = ev->stage[2] = 0;
+	memset(ev->samples, 0, sizeof(ev->samples));		/* Only waveform data lines fill them, others must not carry stale ones */
+
+	if(strstr(line, "Clearing Track ID Status") != NULL)
+	{
+		ev->kind = GATEWAY_EVENT_TRACK_CLEAR;
+	}
+	else if(strstr(line, "Train Arrival Detected") != NULL)
+	{
+		ev->kind  = GATEWAY_EVENT_TRAIN_ARRIVAL;
+		ev->value = (int32_t)gateway_line_value(line, "Train Arrival Detected", 0);
+	}
+	else if(strstr(line, "Faulted Track ID") != NULL)		/* Must be checked before the plain "Track ID" */
+	{
+		ev->kind  = GATEWAY_EVENT_FAULTED_TRACK;
+		ev->track = (int16_t)gateway_line_value(line, "Faulted Track ID", 0);
+	}
+	else if(strstr(line, "Health Status") != NULL)
+	{
+		ev->kind  = GATEWAY_EVENT_SECTION_HEALTH;
+		ev->track = (int16_t)gateway_line_value(line, "Track ID", 0);
+		ev->value = (int32_t)gateway_line_value(line, "Confidence", 0);
+	}
+	else if(strstr(line, "Waveform Data") != NULL)
+	{
+		const char *p = strchr(strstr(line, "Waveform Data"), '=');
+		char *end;
+
+		ev->kind = GATEWAY_EVENT_WAVEFORM_DATA;
+		while(p != NULL && ev->value < GATEWAY_EVENT_SAMPLES)
+		{
+			long sample = strtol(p + 1, &end, 10);
+			if(end == p + 1)
+				break;
+			ev->samples[ev->value++] = (uint16_t)sample;
+			p = end - 1;
+		}
+	}
+	else if(strstr(line, "Waveform Source ID") != NULL)
+	{
+		ev->kind  = GATEWAY_EVENT_WAVEFORM_START;
+		ev->track = (int16_t)gateway_line_value(line, "Waveform Source ID", 0);
+		ev->value = (int32_t)gateway_line_value(line, "Samples", 0);
+	}
+	else if(strstr(line, "Waveform Complete Source ID") != NULL || strstr(line, "Waveform Failed Source ID") != NULL)
+	{
+		ev->kind  = GATEWAY_EVENT_WAVEFORM_END;
+		ev->track = (int16_t)gateway_line_value(line, "Source ID", 0);
+		ev->value = (strstr(line, "Complete") != NULL);
+	}
+	else if(strstr(line, "Waveform Requested Source ID") != NULL)
+	{
+		ev->kind  = GATEWAY_EVENT_WAVEFORM_REQUEST;
+		ev->track = (int16_t)gateway_line_value(line, "Source ID", 0);
+		ev->value = (int32_t)gateway_line_value(line, "Transfer", 0);
+	}
+	else if(strstr(line, "Report Source ID") != NULL)
+	{
+		ev->kind  = GATEWAY_EVENT_REPORT;
+		ev->track = (int16_t)gateway_line_value(line, "Report Source ID", 0);
+	}
+	else if(strstr(line, "Latency Source ID") != NULL)
+	{
+		ev->kind     = GATEWAY_EVENT_LATENCY;
+		ev->track    = (int16_t)gateway_line_value(line, "Source ID", 0);
+		ev->value    = (int32_t)gateway_line_value(line, "Hops", 0);
+		ev->stage[0] = (int32_t)gateway_line_value(line, "Origin", 0);
+		ev->stage[1] = (int32_t)gateway_line_value(line, "Relay", 0);
+		ev->stage[2] = (int32_t)gateway_line_value(line, "Batch", 0);
+	}
+}
+
+/*--------------------------------WRITER SIDE-------------------------------------_*/
+/*--------------------------------------------------------------------------------_*/
+
+/* Publishes ev as the next event. Only the daemon calls this. */
+static inline void gateway_ring_publish(gateway_ring_t *ring, const gateway_event_t *ev)
+{
+	uint64_t seq = ring->head + 1;
+	gateway_slot_t *slot = &ring->slot[seq & (GATEWAY_RING_SLOTS - 1)];
+
+	__atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(&slot->event, ev, sizeof(gateway_event_t));
+	__atomic_store_n(&slot->seq, seq, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->head, seq, __ATOMIC_RELEASE);
+}
+
+/*--------------------------------READER SIDE-------------------------------------_*/
+/*--------------------------------------------------------------------------------_*/
+
+/*
+   Returns the next event in place, or NULL if there is none yet. The pointer stays
+   valid until gateway_ring_done(), which also tells whether the writer overwrote the
+   slot in the meantime. Events lost to overruns are skipped and counted.
+*/
+static inline const gateway_event_t *gateway_ring_peek(gateway_ring_reader_t *r)
+{
+	uint64_t head = __atomic_load_n(&r->ring->head, __ATOMIC_ACQUIRE);
+
+	if(r->next <= head && head - r->next >= GATEWAY_RING_SLOTS - 1)		/* Keep one slot of distance to the writer */
+	{
+		uint64_t oldest = head - (GATEWAY_RING_SLOTS - 2);
+		r->overruns += oldest - r->next;
+		r->next = oldest;
+	}
+
+	while(r->next <= head)
+	{
+		const gateway_slot_t *slot = &r->ring->slot[r->next & (GATEWAY_RING_SLOTS - 1)];
+		if(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == r->next)
+			return &slot->event;
+
+		r->overruns++;		/* Slot already reused by the writer */
+		r->next++;
+	}
+
+	return NULL;
+}
+
+/* Releases the event returned by gateway_ring_peek(). Returns 0 if it was torn by the writer. */
+static inline int gateway_ring_done(gateway_ring_reader_t *r)
+{
+	const gateway_slot_t *slot = &r->ring->slot[r->next & (GATEWAY_RING_SLOTS - 1)];
+
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	int intact = (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == r->next);
+	if(!intact)
+		r->overruns++;
+	r->next++;
+	return intact;
+}
+
+/* Maps the ring read-only and connects to the notification socket. Returns 0 on success. */
+static inline int gateway_ring_attach(gateway_ring_reader_t *r)
+{
+	int fd = shm_open(GATEWAY_RING_SHM_NAME, O_RDONLY, 0);
+	if(fd < 0)
+		return -1;
+
+	void *map = mmap(NULL, sizeof(gateway_ring_t), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+		return -1;
+
+	const gateway_ring_t *ring = (const gateway_ring_t *)map;
+	if(ring->magic != GATEWAY_RING_MAGIC || ring->version != GATEWAY_RING_VERSION || ring->event_size != sizeof(gateway_event_t))
+	{
+		munmap(map, sizeof(gateway_ring_t));
+		return -1;
+	}
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, GATEWAY_RING_SOCKET, sizeof(addr.sun_path) - 1);
+
+	int s = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(s < 0 || connect(s, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	{
+		if(s >= 0)
+			close(s);
+		munmap(map, sizeof(gateway_ring_t));
+		return -1;
+	}
+	fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+
+	r->ring     = ring;
+	r->next     = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) + 1;	/* Start with live events */
+	r->overruns = 0;
+	r->socket   = s;
+	return 0;
+}
+
+/* Consumes pending wake-ups. Returns 0 once the daemon has gone away. */
+static inline int gateway_ring_drain(gateway_ring_reader_t *r)
+{
+	char buf[64];
+	ssize_t n;
+
+	while((n = read(r->socket, buf, sizeof(buf))) > 0)
+		;
+
+	if(n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+		return 0;
+	return 1;
+}
+
+static inline void gateway_ring_detach(gateway_ring_reader_t *r)
+{
+	if(r->socket >= 0)
+		close(r->socket);
+	if(r->ring != NULL)
+		munmap((void *)r->ring, sizeof(gateway_ring_t));
+
+	r->ring   = NULL;
+	r->socket = -1;
+}
+
+#endif /* GATEWAY_RING_H_ */
@@ -0,0 +1,396 @@
+/*
+   Wireless Sensor Networks Laboratory
+
+   Technische Universität München
+   Lehrstuhl für Kommunikationsnetze
+   http://www.lkn.ei.tum.de
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, version 2.0 of the License.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+   GATEWAY DAEMON: Headless ingest of the gateway serial output
+
+   Usage: gatewayd /dev/ttyUSB0 [/dev/ttyUSB1 ...]
+
+   Owns the gateway serial ports, decodes every line once and publishes it into the
+   shared-memory ring described in gateway_ring.h. Readers (GUI, logger, alerting)
+   connect to GATEWAY_RING_SOCKET and get one byte whenever new events are available.
+   Lines a reader writes to the socket starting with GATEWAY_CAPTURE_PREFIX are passed
+   on to the first gateway, which floods the waveform capture request.
+
+   With several gateways on one line, every report a gateway receives is passed on to
+   the other gateways, so each can evaluate the sections it owns with data from motes
+   that route to another sink. Waveform requests and completions are passed on too:
+   the chunks follow the mote's route, so the gateway that collects them may not be
+   the one that asked, and the one that asked must stop repeating its request.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "gateway_ring.h"
+
+#define MAX_GATEWAY_PORTS	8
+#define MAX_CLIENTS			32
+#define LINE_BUFFER_SIZE	256
+
+/*----------------------------DEFINITIONS OF VARIABLES----------------------------_*/
+/*--------------------------------------------------------------------------------_*/
+
+/*! One gateway serial port and the line it is currently assembling */
+typedef struct
+{
+	const char	*name;
+	int			fd;
+	size_t		len;
+	char		line[LINE_BUFFER_SIZE];
+}gateway_port_t;
+
+static gateway_port_t ports[MAX_GATEWAY_PORTS];
+static int no_of_ports = 0;
+
+static int clients[MAX_CLIENTS];
+static int no_of_clients = 0;
+
+static gateway_ring_t *ring = NULL;
+static volatile sig_atomic_t running = 1;
+
+/*-------------------------------HELPER FUNCTIONS---------------------------------_*/
+/*--------------------------------------------------------------------------------_*/
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	running = 0;
+}
+
+static uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* Same settings the GUI used: 115200 baud, 8N1, no flow control, raw */
+static int open_serial(const char *name)
+{
+	struct termios tio;
+	int fd = open(name, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if(fd < 0)
+		return -1;
+
+	if(tcgetattr(fd, &tio) < 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	cfmakeraw(&tio);
+	cfsetispeed(&tio, B115200);
+	cfsetospeed(&tio, B115200);
+	tio.c_cflag |= CLOCAL | CREAD;
+	tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+
+	if(tcsetattr(fd, TCSANOW, &tio) < 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static gateway_ring_t *create_ring(void)
+{
+	int fd = shm_open(GATEWAY_RING_SHM_NAME, O_CREAT | O_RDWR | O_TRUNC, 0644);
+	if(fd < 0)
+		return NULL;
+
+	if(ftruncate(fd, sizeof(gateway_ring_t)) < 0)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	void *map = mmap(NULL, sizeof(gateway_ring_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+		return NULL;
+
+	gateway_ring_t *r = (gateway_ring_t *)map;
+	r->version    = GATEWAY_RING_VERSION;
+	r->slots      = GATEWAY_RING_SLOTS;
+	r->event_size = sizeof(gateway_event_t);
+	r->head       = 0;
+	__atomic_store_n(&r->magic, GATEWAY_RING_MAGIC, __ATOMIC_RELEASE);		/* Readers check the magic last */
+	return r;
+}
+
+static int open_listener(void)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, GATEWAY_RING_SOCKET, sizeof(addr.sun_path) - 1);
+
+	int s = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if(s < 0)
+		return -1;
+
+	unlink(GATEWAY_RING_SOCKET);
+	if(bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(s, MAX_CLIENTS) < 0)
+	{
+		close(s);
+		return -1;
+	}
+
+	return s;
+}
+
+/* Passes a line of one gateway on to all others as "Peer <line>", e.g. "Peer Report Source ID = 3" */
+static void share_line(uint8_t from, const char *text)
+{
+	char line[8 + GATEWAY_EVENT_TEXT];
+	int len = snprintf(line, sizeof(line), "Peer %s\n", text);
+
+	for(int i = 0; i < no_of_ports; i++)
+	{
+		if(i != from && write(ports[i].fd, line, len) != len)
+			fprintf(stderr, "Unable to share \"%s\" with %s\n", text, ports[i].name);
+	}
+}
+
+/* Passes waveform capture requests from a reader on to the first gateway, other input is ignored */
+static void client_commands(char *buf, ssize_t n)
+{
+	char *line = buf;
+	buf[n] = '\0';
+
+	while(line != NULL && *line != '\0')
+	{
+		char *end = strchr(line, '\n');
+		if(end != NULL)
+			*end = '\0';
+
+		if(strncmp(line, GATEWAY_CAPTURE_PREFIX, strlen(GATEWAY_CAPTURE_PREFIX)) == 0)
+		{
+			dprintf(ports[0].fd, "%s\n", line);
+		}
+
+		line = (end != NULL) ? end + 1 : NULL;
+	}
+}
+
+static void drop_client(int i)
+{
+	close(clients[i]);
+	clients[i] = clients[--no_of_clients];
+}
+
+/* One byte per wake-up. A client whose socket is full already has one pending, so it is skipped instead of waited for. */
+static void notify_clients(void)
+{
+	for(int i = 0; i < no_of_clients; )
+	{
+		if(send(clients[i], "e", 1, MSG_DONTWAIT | MSG_NOSIGNAL) < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+		{
+			drop_client(i);
+			continue;
+		}
+		i++;
+	}
+}
+
+/*----------------------------------LINE INGEST-----------------------------------_*/
+/*--------------------------------------------------------------------------------_*/
+
+/* Splits the bytes read from a port into lines and publishes one event per non-empty line. Returns the number published. */
+static int ingest(gateway_port_t *p, uint8_t index, const char *buf, ssize_t n)
+{
+	int published = 0;
+	gateway_event_t ev;
+
+	for(ssize_t i = 0; i < n; i++)
+	{
+		char ch = buf[i];
+
+		if(ch == '\r')
+			continue;
+
+		if(ch != '\n' && p->len < LINE_BUFFER_SIZE - 1)
+		{
+			p->line[p->len++] = ch;
+			continue;
+		}
+
+		if(ch != '\n')			/* Overlong line, dropped until the next newline */
+			continue;
+
+		if(p->len > 0)
+		{
+			p->line[p->len] = '\0';
+			gateway_event_decode(p->line, &ev);
+			ev.rx_time_ns = monotonic_ns();
+			ev.port = index;
+			gateway_ring_publish(ring, &ev);
+			published++;
+
+			if(ev.kind == GATEWAY_EVENT_REPORT || ev.kind == GATEWAY_EVENT_WAVEFORM_REQUEST ||
+					(ev.kind == GATEWAY_EVENT_WAVEFORM_END && ev.value == 1))
+				share_line(index, ev.text);
+		}
+		p->len = 0;
+	}
+
+	return published;
+}
+
+/*-------------------------------------MAIN---------------------------------------_*/
+/*--------------------------------------------------------------------------------_*/
+
+int main(int argc, char **argv)
+{
+	struct pollfd fds[1 + MAX_GATEWAY_PORTS + MAX_CLIENTS];
+	char buf[512];
+
+	if(argc < 2 || argc - 1 > MAX_GATEWAY_PORTS)
+	{
+		fprintf(stderr, "Usage: %s <gateway serial port> [up to %d ports]\n", argv[0], MAX_GATEWAY_PORTS);
+		return 1;
+	}
+
+	for(int i = 1; i < argc; i++)
+	{
+		ports[no_of_ports].name = argv[i];
+		ports[no_of_ports].fd = open_serial(argv[i]);
+		ports[no_of_ports].len = 0;
+		if(ports[no_of_ports].fd < 0)
+		{
+			fprintf(stderr, "Unable to open port %s: %s\n", argv[i], strerror(errno));
+			return 1;
+		}
+		no_of_ports++;
+	}
+
+	ring = create_ring();
+	if(ring == NULL)
+	{
+		fprintf(stderr, "Unable to create shared memory %s: %s\n", GATEWAY_RING_SHM_NAME, strerror(errno));
+		return 1;
+	}
+
+	int listener = open_listener();
+	if(listener < 0)
+	{
+		fprintf(stderr, "Unable to listen on %s: %s\n", GATEWAY_RING_SOCKET, strerror(errno));
+		shm_unlink(GATEWAY_RING_SHM_NAME);
+		return 1;
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	while(running)
+	{
+		int nfds = 0;
+
+		fds[nfds].fd = listener;
+		fds[nfds++].events = POLLIN;
+		for(int i = 0; i < no_of_ports; i++)
+		{
+			fds[nfds].fd = ports[i].fd;
+			fds[nfds++].events = POLLIN;
+		}
+		for(int i = 0; i < no_of_clients; i++)
+		{
+			fds[nfds].fd = clients[i];
+			fds[nfds++].events = POLLIN;			/* Only to notice disconnects */
+		}
+
+		if(poll(fds, nfds, -1) < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+
+		/* Clients first: fds[] still matches clients[] only until notify_clients() drops one */
+		for(int i = no_of_clients - 1; i >= 0; i--)	/* Backwards, drop_client() moves the last one into place */
+		{
+			if(fds[1 + no_of_ports + i].revents & (POLLIN | POLLHUP | POLLERR))
+			{
+				ssize_t n = recv(clients[i], buf, sizeof(buf) - 1, MSG_DONTWAIT);
+				if(n > 0)
+					client_commands(buf, n);
+				else if(n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+					drop_client(i);
+			}
+		}
+
+		int published = 0;
+
+		for(int i = 0; i < no_of_ports; i++)
+		{
+			if(!(fds[1 + i].revents & (POLLIN | POLLHUP | POLLERR)))
+				continue;
+
+			ssize_t n = read(ports[i].fd, buf, sizeof(buf));
+			if(n > 0)
+			{
+				published += ingest(&ports[i], (uint8_t)i, buf, n);
+			}
+			else if(n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+			{
+				fprintf(stderr, "Gateway port %s closed\n", ports[i].name);
+				running = 0;
+			}
+		}
+
+		if(published > 0)
+			notify_clients();
+
+		if(fds[0].revents & POLLIN)
+		{
+			int c;
+			while((c = accept4(listener, NULL, NULL, SOCK_NONBLOCK)) >= 0)
+			{
+				if(no_of_clients == MAX_CLIENTS)
+					close(c);
+				else
+					clients[no_of_clients++] = c;
+			}
+		}
+	}
+
+	for(int i = 0; i < no_of_clients; i++)
+		close(clients[i]);
+	for(int i = 0; i < no_of_ports; i++)
+		close(ports[i].fd);
+	close(listener);
+	unlink(GATEWAY_RING_SOCKET);
+	shm_unlink(GATEWAY_RING_SHM_NAME);
+	return 0;
+}
@@ -31,6 +31,213 @@
 #include "ui_mainwindow.h"
 #include <qdebug.h>
 #include <QLCDNumber>
+#include <QFile>
+#include <QSocketNotifier>
+#include <QElapsedTimer>
+#include <QPainter>
+#include <QPixmap>
+#include <QPolygonF>
+#include <QVector>
+#include <algorithm>
+#include <time.h>
+
+#include "../../Daemon Code/Gatewayd/gateway_ring.h"
+
+#define GATEWAYD_INTERFACE  "gatewayd"      /* Combo box entry to read from the ingest daemon instead of a port */
+
+/* Connection to the gateway ingest daemon, used instead of the serial port when GATEWAYD_INTERFACE is selected */
+static gateway_ring_reader_t ring_reader = {NULL, 0, 0, -1};
+static QSocketNotifier *ring_notifier = NULL;
+
+/* Sliding windows of the most recent alarm latency samples in ms, shown as p50/p99 */
+#define LATENCY_WINDOW      128
+#define LATENCY_MAX_HOPS    8
+
+enum { STAGE_ORIGIN, STAGE_RELAY, STAGE_BATCH, STAGE_INGEST, STAGE_DECODE, STAGE_RENDER, STAGE_COUNT };
+
+static const char *stage_names[STAGE_COUNT] =
+{
+    "Origin (ADC sample to MAC sent)", "Relay hold + MAC (all hops)", "Gateway 60s batch",
+    "Ingest (gatewayd to GUI)", "Decode and display", "Render"
+};
+
+typedef struct
+{
+    double  sample[LATENCY_WINDOW];
+    int     count;
+    int     next;
+}latency_series_t;
+
+static latency_series_t stage_latency[STAGE_COUNT];
+static latency_series_t hop_latency[LATENCY_MAX_HOPS + 1];     /* Origin + relay + batch, by hop count */
+static bool latency_changed = false;           /* New samples from the gateway since the panel was updated */
+
+static void latency_add(latency_series_t *series, double ms)
+{
+    series->sample[series->next] = ms;
+    series->next = (series->next + 1) % LATENCY_WINDOW;
+    if (series->count < LATENCY_WINDOW)
+        series->count++;
+}
+
+static double latency_percentile(const latency_series_t *series, int percent)
+{
+    double sorted[LATENCY_WINDOW];
+    std::copy(series->sample, series->sample + series->count, sorted);
+    std::sort(sorted, sorted + series->count);
+    return sorted[(series->count - 1) * percent / 100];
+}
+
+static QString latency_row(const QString &name, const latency_series_t *series)
+{
+    return QString("%1: p50 %2 ms, p99 %3 ms (%4)").arg(name)
+            .arg(latency_percentile(series, 50), 0, 'f', 1)
+            .arg(latency_percentile(series, 99), 0, 'f', 1)
+            .arg(series->count);
+}
+
+static void show_latency(Ui::MainWindow *ui)
+{
+    QStringList rows;
+
+    rows << "Per stage:";
+    for (int i = 0; i < STAGE_COUNT; i++)
+    {
+        if (stage_latency[i].count > 0)
+            rows << latency_row(stage_names[i], &stage_latency[i]);
+    }
+
+    rows << "" << "Sample to gateway batch, per hop count:";
+    for (int i = 0; i <= LATENCY_MAX_HOPS; i++)
+    {
+        if (hop_latency[i].count > 0)
+            rows << latency_row(QString("%1 hops").arg(i), &hop_latency[i]);
+    }
+
+    ui->textEdit_Latency->setPlainText(rows.join("\n"));
+    latency_changed = false;
+}
+
+/* Raw ADC samples of the waveform being received from the gateway */
+static QVector<uint16_t> waveform_samples;
+
+static void plot_waveform(Ui::MainWindow *ui, int source)
+{
+    QLabel *label = ui->label_Waveform;
+    QPixmap pixmap(label->size());
+    pixmap.fill(Qt::white);
+
+    if (waveform_samples.size() > 1)
+    {
+        double low = *std::min_element(waveform_samples.begin(), waveform_samples.end());
+        double high = *std::max_element(waveform_samples.begin(), waveform_samples.end());
+        double width = pixmap.width() - 1, height = pixmap.height() - 1;
+        QPolygonF points;
+
+        if (high == low)
+            high = low + 1;
+
+        for (int i = 0; i < waveform_samples.size(); i++)
+        {
+            points << QPointF(i * width / (waveform_samples.size() - 1),
+                              height - (waveform_samples[i] - low) * height / (high - low));
+        }
+
+        QPainter painter(&pixmap);
+        painter.setPen(Qt::blue);
+        painter.drawPolyline(points);
+        painter.setPen(Qt::black);
+        painter.drawText(4, 14, QString("Mote %1: %2 samples, ADC %3 to %4")
+                         .arg(source).arg(waveform_samples.size()).arg(low).arg(high));
+    }
+
+    label->setPixmap(pixmap);
+}
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* Updates the track display for one decoded gateway line */
+static void show_event(Ui::MainWindow *ui, const gateway_event_t *ev)
+{
+    ui->textEdit_Status->append(QString::fromLocal8Bit(ev->text));
+
+    switch (ev->kind)
+    {
+    case GATEWAY_EVENT_TRACK_CLEAR:                 /* clearing each track section status*/
+        ui->trackID2->display(0);
+        ui->trackID3->display(0);
+        ui->trackID4->display(0);
+        ui->trackID5->display(0);
+        ui->trackID6->display(0);
+        ui->track_status->display(0);
+        ui->lcdNumber_light->display(0);
+        ui->trackID2->setPalette(Qt::red);
+        break;
+
+    case GATEWAY_EVENT_TRAIN_ARRIVAL:               /* Display of arrival detection*/
+        ui->lcdNumber_light->display(ev->value);
+        break;
+
+    case GATEWAY_EVENT_FAULTED_TRACK:               /* Fault Track ID display on Faulted Mode ID box*/
+        if(ev->track == 2)                          /* Binary value changed to 1 on specific mote ID box*/
+            ui->trackID2->display(1);
+        else if(ev->track == 3)
+            ui->trackID3->display(1);
+        else if(ev->track == 4)
+            ui->trackID4->display(1);
+        else if(ev->track == 5)
+            ui->trackID5->display(1);
+        else if(ev->track == 6)
+            ui->trackID6->display(1);
+
+        ui->track_status->display(ev->track);
+        break;
+
+    case GATEWAY_EVENT_LATENCY:                     /* Stage delays measured on the motes and the gateway */
+        latency_add(&stage_latency[STAGE_ORIGIN], ev->stage[0]);
+        latency_add(&stage_latency[STAGE_RELAY], ev->stage[1]);
+        latency_add(&stage_latency[STAGE_BATCH], ev->stage[2]);
+        latency_add(&hop_latency[std::min<int>(ev->value, LATENCY_MAX_HOPS)], ev->stage[0] + ev->stage[1] + ev->stage[2]);
+        latency_changed = true;
+        break;
+
+    case GATEWAY_EVENT_WAVEFORM_START:
+        waveform_samples.clear();
+        waveform_samples.reserve(ev->value);
+        break;
+
+    case GATEWAY_EVENT_WAVEFORM_DATA:
+        for (int i = 0; i < ev->value; i++)
+            waveform_samples.append(ev->samples[i]);
+        break;
+
+    case GATEWAY_EVENT_WAVEFORM_END:
+        if (ev->value == 1)
+            plot_waveform(ui, ev->track);
+        break;
+
+    default:
+        break;
+    }
+}
+
+/* Repaints the window immediately and records how long that took */
+static void render(QWidget *window, Ui::MainWindow *ui)
+{
+    QElapsedTimer timer;
+
+    timer.start();
+    window->repaint();
+    latency_add(&stage_latency[STAGE_RENDER], timer.nsecsElapsed() / 1e6);
+
+    if (latency_changed)
+        show_latency(ui);
+}
 
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
@@ -50,6 +257,24 @@ MainWindow::MainWindow(QWidget *parent) :
             ui->comboBox_Interface->addItem(ports.at(i).portName.toLocal8Bit().constData());
         }
     }
+    // Offer the ingest daemon if it is running.
+    if (QFile::exists(GATEWAY_RING_SOCKET))
+    {
+        ui->comboBox_Interface->insertItem(0, GATEWAYD_INTERFACE);
+        ui->comboBox_Interface->setCurrentIndex(0);
+    }
+    // Ask the gateway to record and send a raw waveform of the selected mote.
+    QObject::connect(ui->pushButton_capture, &QPushButton::clicked, this, [this]()
+    {
+        QByteArray command = QString("%1%2\n").arg(GATEWAY_CAPTURE_PREFIX)
+                .arg(ui->spinBox_Capture->value()).toLocal8Bit();
+
+        if (ring_notifier != NULL)
+            ::write(ring_reader.socket, command.constData(), command.size());
+        else if (port.isOpen())
+            port.write(command);
+    });
+
     // Show a hint if no USB ports were found.
     if (ui->comboBox_Interface->count() == 0){
         ui->textEdit_Status->insertPlainText("No USB ports available.\nConnect a USB device and try again.");
@@ -76,6 +301,25 @@ void MainWindow::changeEvent(QEvent *e)
 
 void MainWindow::on_pushButton_open_clicked()
 {
+    if (ui->comboBox_Interface->currentText() == GATEWAYD_INTERFACE)
+    {
+        if (gateway_ring_attach(&ring_reader) != 0)
+        {
+            error.setText("Unable to connect to gatewayd!");
+            error.show();
+            return;
+        }
+
+        ring_notifier = new QSocketNotifier(ring_reader.socket, QSocketNotifier::Read, this);
+        QObject::connect(ring_notifier, SIGNAL(activated(int)), this, SLOT(receive()));
+
+        ui->pushButton_close->setEnabled(true);
+        ui->pushButton_capture->setEnabled(true);
+        ui->pushButton_open->setEnabled(false);
+        ui->comboBox_Interface->setEnabled(false);
+        return;
+    }
+
     port.setQueryMode(QextSerialPort::EventDriven);
     port.setPortName("/dev/" + ui->comboBox_Interface->currentText());
     port.setBaudRate(BAUD115200);
@@ -95,6 +339,7 @@ void MainWindow::on_pushButton_open_clicked()
     QObject::connect(&port, SIGNAL(readyRead()), this, SLOT(receive()));
 
     ui->pushButton_close->setEnabled(true);
+    ui->pushButton_capture->setEnabled(true);
     ui->pushButton_open->setEnabled(false);
     ui->comboBox_Interface->setEnabled(false);
 }
@@ -102,13 +347,55 @@ void MainWindow::on_pushButton_open_clicked()
 void MainWindow::on_pushButton_close_clicked()
 {
     if (port.isOpen())port.close();
+    if (ring_notifier != NULL)
+    {
+        ring_notifier->setEnabled(false);      // May be called from its own activated() signal, see receive()
+        ring_notifier->deleteLater();
+        ring_notifier = NULL;
+        gateway_ring_detach(&ring_reader);
+    }
     ui->pushButton_close->setEnabled(false);
+    ui->pushButton_capture->setEnabled(false);
     ui->pushButton_open->setEnabled(true);
     ui->comboBox_Interface->setEnabled(true);
 }
 
 void MainWindow::receive()
 {
+    if (ring_notifier != NULL)      // Events are already decoded by the daemon
+    {
+        uint64_t overruns = ring_reader.overruns;
+        const gateway_event_t *ev;
+        gateway_event_t copy;
+
+        if (!gateway_ring_drain(&ring_reader))
+        {
+            ui->textEdit_Status->append("gatewayd has stopped.");
+            on_pushButton_close_clicked();
+            return;
+        }
+
+        while ((ev = gateway_ring_peek(&ring_reader)) != NULL)
+        {
+            QElapsedTimer decode;
+            decode.start();
+            memcpy(&copy, ev, sizeof(copy));            // The slot may be reused while it is copied, done() tells
+            if (!gateway_ring_done(&ring_reader))
+                continue;
+            latency_add(&stage_latency[STAGE_INGEST], (monotonic_ns() - copy.rx_time_ns) / 1e6);
+            show_event(ui, &copy);
+            latency_add(&stage_latency[STAGE_DECODE], decode.nsecsElapsed() / 1e6);
+        }
+
+        if (ring_reader.overruns != overruns)
+        {
+            ui->textEdit_Status->append(QString("%1 gateway events were skipped.").arg(ring_reader.overruns - overruns));
+        }
+
+        render(this, ui);
+        return;
+    }
+
     static QString str;
         char ch;
         while (port.getChar(&ch))
@@ -116,89 +403,16 @@ void MainWindow::receive()
             str.append(ch);
             if (ch == '\n')     // End of line, start decoding
             {
+                gateway_event_t ev;
+                QElapsedTimer decode;
+
+                decode.start();
                 str.remove("\n", Qt::CaseSensitive);
-                ui->textEdit_Status->append(str);
-
-                if (str.contains("Clearing Track ID Status"))        /* clearing each track section status*/
-                 {
-                     ui->trackID2->display(0);
-                     ui->trackID3->display(0);
-                     ui->trackID4->display(0);
-                     ui->trackID5->display(0);
-                     ui->trackID6->display(0);
-                     ui->track_status->display(0);
-                     ui->lcdNumber_light->display(0);
-                     ui->trackID2->setPalette(Qt::red);
-
-                }
-
-                if (str.contains("Train Arrival Detected ="))       /* Display of arrival detection*/
-                {
-
-                    double value;
-                    QStringList list = str.split(QRegExp("\\s"));
-
-                    qDebug() << "Str value: " << str;
-                    if(!list.isEmpty())
-                    {
-                        qDebug() << "List size " << list.size();
-                        for (int i=0; i < list.size(); i++)
-                        {
-                            qDebug() << "List value "<< i <<" "<< list.at(i);
-                            if (list.at(i) == "=")
-                            {
-                                value = list.at(i+1).toDouble();
-                                //adjust to Degrees
-                                printf("%f\n",value);
-                            }
-                        }
-                    }
-
-                    qDebug() << "Var value " << QString::number(value);
-                    ui->lcdNumber_light->display(value);
-                }
-
-                if (str.contains("Faulted Track ID = "))        /* Fault Track ID display on Faulted Mode ID box*/
-                {
-
-                    double track_status;
-                    QStringList list = str.split(QRegExp("\\s"));
-
-                    qDebug() << "Str value: " << str;
-                    if(!list.isEmpty())
-                    {
-                        qDebug() << "List size " << list.size();
-                        for (int i=0; i < list.size(); i++)
-                        {
-                            qDebug() << "List value "<< i <<" "<< list.at(i);
-                            if (list.at(i) == "=")
-                            {
-                                track_status = list.at(i+1).toDouble();
-                                //adjust to Degrees
-                                printf("%f\n",track_status);
-                            }
-                        }
-                    }
-
-                    if(track_status == 2)                         /* Binary value changed to 1 on specific mote ID box*/
-                        ui->trackID2->display(1);
-                    else if(track_status == 3)
-                        ui->trackID3->display(1);
-                    else if(track_status == 4)
-                        ui->trackID4->display(1);
-                    else if(track_status == 5)
-                        ui->trackID5->display(1);
-                    else if(track_status == 6)
-                        ui->trackID6->display(1);
-
-
-                    qDebug() << "Var value " << QString::number(track_status);
-                    ui->track_status->display(track_status);
-                }
-
-
-
-                this->repaint();    // Update content of window immediately
+                gateway_event_decode(str.toLocal8Bit().constData(), &ev);
+                show_event(ui, &ev);
+                latency_add(&stage_latency[STAGE_DECODE], decode.nsecsElapsed() / 1e6);
+
+                render(this, ui);
                 str.clear();
             }
         }
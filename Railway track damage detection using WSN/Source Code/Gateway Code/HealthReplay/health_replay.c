@@ -0,0 +1,289 @@
+/*
+   Wireless Sensor Networks Laboratory
+
+   Technische Universität München
+   Lehrstuhl für Kommunikationsnetze
+   http://www.lkn.ei.tum.de
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, version 2.0 of the License.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+   HEALTH REPLAY: Detection delay against false alarms of the section health score
+
+   Usage: health_replay [-l loss] [-b break rate] [-m mismatch llr] [-a match llr]
+                        [-t threshold] [-n sections] [-p passes] [-s seed]
+          health_replay -f gateway.log [-m ..] [-a ..] [-t ..]
+
+   Synthetic mode replays pass sequences of independent sections through health_update()
+   from health_score.h. Every report is lost with the given probability. A healthy section
+   breaks with the given probability per pass; afterwards the mote behind the break no
+   longer senses the train. Reported per setting:
+     FA/1k   false alarms per 1000 passes over a healthy section (alarm cleared after each)
+     delay   mean and 95th percentile passes from the break to the alarm
+     missed  breaks not detected within the pass budget
+   Without -l and -t a grid of loss rates and thresholds is swept.
+
+   Log mode replays the "MoteID = x   Vibration = y" windows of a recorded gateway serial
+   log and prints every alarm change, to try other settings on real passes.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "health_score.h"
+
+#define MAX_NO_OF_MOTES		64
+#define MAX_DELAYS			100000
+
+/*----------------------------DEFINITIONS OF VARIABLES----------------------------_*/
+/*--------------------------------------------------------------------------------_*/
+
+/*! Result of one setting */
+typedef struct
+{
+	double	false_alarms;			/* Per 1000 healthy passes */
+	double	mean_delay;				/* Passes */
+	int		p95_delay;
+	int		missed;
+	int		breaks;
+}replay_result_t;
+
+static uint64_t rng_state = 88172645463325252ull;
+static int delays[MAX_DELAYS];
+
+/*-------------------------------HELPER FUNCTIONS---------------------------------_*/
+/*--------------------------------------------------------------------------------_*/
+
+/* xorshift64, so runs are reproducible on every host */
+static double uniform(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return (rng_state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int compare_int(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+/*-------------------------------SYNTHETIC REPLAY---------------------------------_*/
+/*--------------------------------------------------------------------------------_*/
+
+/* One section over at most `passes` train passes. Returns the delay in passes after the break, -1 if missed, -2 if it never broke. */
+static int replay_section(const health_params_t *p, double loss, double break_rate, int passes,
+		long *healthy_passes, long *false_alarms)
+{
+	health_t h = {0, 0};
+	int broken_at = -1;
+
+	for(int pass = 0; pass < passes; pass++)
+	{
+		if(broken_at < 0 && uniform() < break_rate)
+			broken_at = pass;
+
+		uint8_t near = uniform() >= loss;								/* Report of the mote before the section reached a gateway */
+		uint8_t far = (broken_at < 0) && uniform() >= loss;				/* The mote behind a break does not sense the train */
+
+		health_update(&h, p, near != far);
+
+		if(broken_at >= 0)
+		{
+			if(h.alarm)
+				return pass - broken_at;
+			continue;
+		}
+
+		(*healthy_passes)++;
+		if(h.alarm)
+		{
+			(*false_alarms)++;
+			h.score = 0;												/* Section inspected and cleared */
+			h.alarm = 0;
+		}
+	}
+
+	return (broken_at < 0) ? -2 : -1;
+}
+
+static replay_result_t replay(const health_params_t *p, double loss, double break_rate, int sections, int passes)
+{
+	replay_result_t r;
+	long healthy_passes = 0, false_alarms = 0;
+	double sum = 0;
+
+	memset(&r, 0, sizeof(r));
+
+	for(int s = 0; s < sections; s++)
+	{
+		int delay = replay_section(p, loss, break_rate, passes, &healthy_passes, &false_alarms);
+
+		if(delay == -1)
+		{
+			r.breaks++;
+			r.missed++;
+		}
+		else if(delay >= 0)
+		{
+			if(r.breaks - r.missed < MAX_DELAYS)
+				delays[r.breaks - r.missed] = delay;
+			r.breaks++;
+			sum += delay;
+		}
+	}
+
+	int detected = r.breaks - r.missed;
+	if(detected > MAX_DELAYS)
+		detected = MAX_DELAYS;
+	if(detected > 0)
+	{
+		qsort(delays, detected, sizeof(int), compare_int);
+		r.mean_delay = sum / (r.breaks - r.missed);
+		r.p95_delay = delays[detected * 95 / 100];
+	}
+	r.false_alarms = healthy_passes ? 1000.0 * false_alarms / healthy_passes : 0;
+	return r;
+}
+
+/*----------------------------------LOG REPLAY------------------------------------_*/
+/*--------------------------------------------------------------------------------_*/
+
+/* Feeds every train window of a gateway log through the score, like callback_array_processing() */
+static int replay_log(const char *name, const health_params_t *p)
+{
+	FILE *f = fopen(name, "r");
+	char line[256];
+	uint8_t vibration[MAX_NO_OF_MOTES] = {0};
+	health_t health[MAX_NO_OF_MOTES] = {{0, 0}};
+	int motes = 0, window = 0;
+
+	if(f == NULL)
+	{
+		perror(name);
+		return 1;
+	}
+
+	while(fgets(line, sizeof(line), f) != NULL)
+	{
+		int id, value;
+		char *s;
+
+		if((s = strstr(line, "MoteID = ")) != NULL && sscanf(s, "MoteID = %d Vibration = %d", &id, &value) == 2)
+		{
+			if(id >= 1 && id <= MAX_NO_OF_MOTES)
+			{
+				vibration[id - 1] = value != 0;
+				if(id > motes)
+					motes = id;
+			}
+		}
+		else if(strstr(line, "Train Arrival Detected = ") != NULL)
+		{
+			window++;
+			if(strstr(line, "= 1") != NULL)
+			{
+				for(int i = 0; i + 2 < motes; i++)
+				{
+					uint8_t was = health[i].alarm;
+					health_update(&health[i], p, vibration[i] != vibration[i+2]);
+					if(health[i].alarm != was)
+						printf("window %d: Track ID %d %s\n", window, i+2, health[i].alarm ? "FAULTY" : "HEALTHY");
+				}
+			}
+			memset(vibration, 0, sizeof(vibration));
+		}
+	}
+
+	fclose(f);
+
+	printf("%d windows replayed\n", window);
+	for(int i = 0; i + 2 < motes; i++)
+		printf("Track ID = %d   Health Status = %s   Confidence = %d\n", i+2, health[i].alarm ? "FAULTY" : "HEALTHY", health_confidence(&health[i], p));
+	return 0;
+}
+
+/*-------------------------------------MAIN---------------------------------------_*/
+/*--------------------------------------------------------------------------------_*/
+
+static void print_result(const health_params_t *p, double loss, const replay_result_t *r)
+{
+	printf("%4d:%-3d %9d %6.0f%% %6.0f%% %8.2f %8.1f %6d %6d/%d\n", p->llr_mismatch, p->llr_match, p->threshold,
+			loss * 100, 200 * loss * (1 - loss), r->false_alarms, r->mean_delay, r->p95_delay, r->missed, r->breaks);
+}
+
+int main(int argc, char **argv)
+{
+	static const double sweep_loss[] = {0.01, 0.05, 0.10, 0.15, 0.20, 0.25};
+	static const uint8_t sweep_threshold[] = {6, 8, 9, 12, 16};
+	health_params_t p = HEALTH_PARAMS_DEFAULT;
+	double loss = -1, break_rate = 0.005;
+	int sections = 20000, passes = 2000, threshold = -1;
+	const char *log = NULL;
+	int opt;
+
+	while((opt = getopt(argc, argv, "l:b:m:a:t:n:p:s:f:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'l': loss = atof(optarg); break;
+			case 'b': break_rate = atof(optarg); break;
+			case 'm': p.llr_mismatch = (uint8_t)atoi(optarg); break;
+			case 'a': p.llr_match = (uint8_t)atoi(optarg); break;
+			case 't': threshold = atoi(optarg); break;
+			case 'n': sections = atoi(optarg); break;
+			case 'p': passes = atoi(optarg); break;
+			case 's': rng_state = strtoull(optarg, NULL, 0) | 1; break;
+			case 'f': log = optarg; break;
+			default:
+				fprintf(stderr, "Usage: %s [-l loss] [-b break rate] [-m mismatch llr] [-a match llr] [-t threshold]"
+						" [-n sections] [-p passes] [-s seed] [-f gateway log]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if(threshold > 127 || p.llr_match == 0 || p.llr_mismatch == 0)
+	{
+		fprintf(stderr, "Weights must be positive and the threshold at most 127\n");
+		return 1;
+	}
+	if(threshold > 0)
+		p.threshold = (uint8_t)threshold;
+
+	if(log != NULL)
+		return replay_log(log, &p);
+
+	printf("Break rate %.4f per pass, %d sections of %d passes\n\n", break_rate, sections, passes);
+	printf("  LLR M:A threshold   loss mismatch    FA/1k     mean    p95   missed\n");
+
+	for(unsigned t = 0; t < sizeof(sweep_threshold); t++)
+	{
+		if(threshold < 0)
+			p.threshold = sweep_threshold[t];
+		else if(t > 0)
+			break;
+
+		for(unsigned l = 0; l < sizeof(sweep_loss) / sizeof(sweep_loss[0]); l++)
+		{
+			double rate = (loss < 0) ? sweep_loss[l] : loss;
+			replay_result_t r = replay(&p, rate, break_rate, sections, passes);
+			print_result(&p, rate, &r);
+			if(loss >= 0)
+				break;
+		}
+	}
+
+	return 0;
+}
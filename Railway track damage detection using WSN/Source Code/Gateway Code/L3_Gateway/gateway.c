@@ -33,18 +33,66 @@
 #include "dev/leds.h"			// Use LEDs.
 #include "sys/clock.h"			// Use CLOCK_SECOND.
 #include "net/rime/rime.h"		// Establish connections.
-#include "dev/cc2538-rf.h"
-#include "dev/adc-zoul.h"      	// ADC
-#include "dev/zoul-sensors.h"  	// Sensor functions
+#include "dev/serial-line.h"	// Section data shared by other gateways
 // Standard C includes:
 #include <stdio.h>				// For printf.
+#include <stdlib.h>
+#include <string.h>
 #include "sys/etimer.h"
 #include "sys/ctimer.h"
 
-#include "dev/cc2538-rf.h"
 #include "lib/random.h"
 
-#define MAX_NO_OF_MOTES	6
+#ifdef CONTIKI_TARGET_COOJA		// Simulation: no ADC, trains are injected with TRAIN_PASS_LINE
+#define ADC1_VALUE()	1000
+#else
+#include "dev/cc2538-rf.h"
+#include "dev/adc-zoul.h"      	// ADC
+#include "dev/zoul-sensors.h"  	// Sensor functions
+#define ADC1_VALUE()	(adc_zoul.value(ZOUL_SENSORS_ADC1) >> 4)
+#endif
+
+#include "health_score.h"			// Section health estimator, shared with the host replay tool
+
+/* CHANNEL, TX_POWER, MAX_NO_OF_MOTES and the multi-channel plan come from the motes' project-conf.h, see the Makefile */
+#ifndef MC_HOME_CHANNEL
+#error "Build with the Makefile, it includes Routing Code/L5_Routing/project-conf.h"
+#endif
+#if ((MC_RENDEZVOUS_PERIOD * MC_DISCOVERY_PERIODS) & (MC_RENDEZVOUS_PERIOD * MC_DISCOVERY_PERIODS - 1)) != 0
+#error "MC_RENDEZVOUS_PERIOD and MC_DISCOVERY_PERIODS must be powers of two, or discovery periods are skipped when the epoch clock wraps"
+#endif
+
+/*! Sections evaluated by this gateway. With several gateways on one line, give each its own range, e.g. via CFLAGS. */
+#ifndef GATEWAY_FIRST_TRACK_ID
+#define GATEWAY_FIRST_TRACK_ID	2
+#endif
+#ifndef GATEWAY_LAST_TRACK_ID
+#define GATEWAY_LAST_TRACK_ID	(MAX_NO_OF_MOTES - 1)
+#endif
+#define OWNS_TRACK(id)			((id) >= GATEWAY_FIRST_TRACK_ID && (id) <= GATEWAY_LAST_TRACK_ID)
+
+#define PEER_REPORT_PREFIX		"Peer Report Source ID = "		/* Written to the serial line by the host for reports another gateway received */
+#define PASS_QUIET_TICKS		(CLOCK_SECOND*20)				/* A train pass is over once no report, own or peer, came for this long */
+#define PASS_MAX_HOLDS			9								/* Evaluated anyway after this many holds, e.g. on a noisy gateway ADC */
+#define CAPTURE_PREFIX			"Capture Source ID = "			/* Written to the serial line by the host to request a waveform */
+#define PEER_CAPTURE_PREFIX		"Peer Waveform Requested Source ID = "	/* Written by the host when another gateway requested a waveform */
+#define PEER_COMPLETE_PREFIX	"Peer Waveform Complete Source ID = "	/* Written by the host when another gateway collected it */
+#define TRANSFER_KEY			"Transfer = "
+
+/*! Waveform capture, must match routing.c */
+#define CAPTURE_SAMPLES			256
+#define CAPTURE_CHUNK_SAMPLES	16
+#define CAPTURE_CHUNKS			(CAPTURE_SAMPLES / CAPTURE_CHUNK_SAMPLES)
+#define CAPTURE_ALL_CHUNKS		((uint16_t)((1UL << CAPTURE_CHUNKS) - 1))
+#define CAPTURE_CHUNK_BYTES		48
+#define CAPTURE_DELTA_ESCAPE	((int8_t)-128)
+#define CAPTURE_NACK_TIMEOUT	(CLOCK_SECOND*8)				/* No chunk for this long: ask again for the missing ones */
+#define CAPTURE_REQUEST_TIMEOUT	(CLOCK_SECOND*15 + MULTI_CHANNEL*MC_RENDEZVOUS_PERIOD)	/* 2 s recording, 4 s of chunks, the flood and slack */
+#define CAPTURE_MAX_RETRIES		4
+
+#define CAPTURE_REQUEST			1
+#define CAPTURE_NACK			2
+
 /*-----------------------------FUNCTION PROTOTYPES--------------------------------_*/
 /*--------------------------------------------------------------------------------_*/
 
@@ -58,6 +106,14 @@ static void unicast_recv(struct unicast_conn *c, const linkaddr_t *from);
 static struct unicast_conn unicast;
 static const struct unicast_callbacks unicast_call = {unicast_recv};
 
+/*! Waveform capture: commands are flooded, chunks come back like vibration reports */
+static struct broadcast_conn captureConn;
+static const struct broadcast_callbacks capture_callbacks = {NULL};
+
+static void bulk_recv(struct unicast_conn *c, const linkaddr_t *from);
+static struct unicast_conn bulk;
+static const struct unicast_callbacks bulk_call = {bulk_recv};
+
 
 /*--------------------------CTIMER DECLARATIONS-----------------------------------_*/
 /*--------------------------------------------------------------------------------_*/
@@ -65,11 +121,18 @@ static const struct unicast_callbacks unicast_call = {unicast_recv};
 static void callback_off(void *ptr);							// Call when ALL LEDs are to be turned OFF
 static void callback_vibration(void *ptr);						// Call each second to sense vibrations
 static void callback_array_processing(void *ptr);				// Call every 60s to run detecting algorithm
+static void callback_capture_timeout(void *ptr);				// Call when a waveform transfer has stalled
+static void callback_capture_command(void *ptr);				// Call when a deferred capture command can be flooded
+static void callback_rendezvous(void *ptr);						// Call at the start and end of every rendezvous window
 
 static struct ctimer ctimer_array_processing;					// Used for 60s delay for detecting algorithm
 static struct ctimer ctimer_vibration_sensing;					// Used for 1s delay for sensing vibrations
 static struct ctimer ctimer_vibration_LED;						// Used for blinking LED for 1s when vibrations are detected on gateway
 static struct ctimer ctimer_unicast_LED;						// Used for blinking LED for 1s when unicast packet is received
+static struct ctimer ctimer_capture_timeout;					// Used to request missing waveform chunks
+static struct ctimer ctimer_capture_command;					// Used to hold capture commands until the rendezvous window
+static struct ctimer ctimer_rendezvous;							// Used to switch between rendezvous and home channel
+static struct ctimer ctimer_beacon;								// Used to send the LUT inside the rendezvous window
 
 
 /*----------------------------DEFINITIONS OF VARIABLES----------------------------_*/
@@ -79,32 +142,135 @@ static struct ctimer ctimer_unicast_LED;						// Used for blinking LED for 1s wh
 typedef struct  {
 	uint8_t source_id;
 	uint16_t vibration_value;
+	uint8_t hop_count;				/* Number of relays the report has passed */
+	uint16_t origin_delay;			/* Ticks from the ADC sample until the source's MAC has sent it */
+	uint16_t queue_delay;			/* Ticks spent inside relays and their MACs, summed over all hops */
 }packet_t;
 
+/*! Timing of the first report of each mote in the current 60s window */
+typedef struct
+{
+	clock_time_t	rx_time;		/* Gateway receipt, 0 if no report arrived */
+	uint8_t			hop_count;
+	uint16_t		origin_delay;
+	uint16_t		queue_delay;
+}report_timing_t;
+
 /*! Look-up table/ Broadcast packet */
 typedef struct
 {
 	linkaddr_t 	next_hop;			/* Next hop in route to destination */
 	uint16_t 	cost;
 	uint16_t 	battery;
+	uint8_t		sink;				/* Gateway the route leads to */
+	uint8_t		epoch_sink;			/* Gateway whose clock is the network epoch, the lowest ID heard */
+	uint8_t		epoch_hops;			/* Hops from the sender to epoch_sink, 0 while that is this gateway */
+	uint32_t	sink_clock;			/* Epoch clock, defines the report slots and rendezvous windows */
 }l_table;
 
 static l_table lut =
 {
-	.next_hop.u8[1] = 0x05, .cost= 0, .battery=80,
+	.cost= 0, .battery=80, .epoch_hops = 0,	/* next_hop, sink and epoch_sink are this gateway, set at start-up */
 };
 
+static uint32_t epoch_offset;			/* Epoch clock minus local clock, 0 while this gateway is the epoch sink */
+static uint8_t epoch_age;				/* Beacons sent since another gateway's epoch was last refreshed */
+
 /* Stores the binary information if a certain mote has sensed the vibrations or not */
 uint8_t vibration_array[MAX_NO_OF_MOTES] = {0};	/*TODO: Change into bool */
 
+static uint8_t gateway_index;			/* Index of this gateway in vibration_array, its mote ID - 1 */
+static clock_time_t last_report_time;	/* Latest report of the current train pass, own or from a peer gateway */
+static uint8_t pass_open = 0;			/* Reports arrived that the window has not evaluated yet */
+
+/* Accumulated evidence and latched alarm for each section of the track, index 0 means Track ID 2 */
+static health_t health[MAX_NO_OF_MOTES - 2];
+static const health_params_t health_params = HEALTH_PARAMS_DEFAULT;
+
+static report_timing_t report_timing[MAX_NO_OF_MOTES];
+
+/*! Command to the motes, flooded over the whole network */
+typedef struct
+{
+	uint8_t type;					/* CAPTURE_REQUEST or CAPTURE_NACK */
+	uint8_t seq;					/* Flood sequence number */
+	uint8_t target;					/* Mote ID that has to act on the command */
+	uint8_t transfer_id;
+	uint16_t missing;				/* NACK: chunks to send again, 0 ends the transfer */
+}capture_cmd_t;
+
+/*! One delta-compressed fragment of a waveform */
+typedef struct
+{
+	uint8_t source_id;
+	uint8_t transfer_id;
+	uint8_t index;
+	uint8_t length;
+	uint8_t data[CAPTURE_CHUNK_BYTES];
+}capture_chunk_t;
+
+/* Waveform being reassembled. Chunks follow the mote's route to any gateway, so whichever receives them collects and reports
+   them. The host tells every gateway which transfer was requested and the requesting one when another has completed it. */
+static uint16_t waveform[CAPTURE_SAMPLES];
+static uint8_t waveform_source = 0;				/* Mote ID, 0 if no transfer was requested yet */
+static uint8_t waveform_transfer;
+static uint8_t waveform_requested;				/* 1 if this gateway flooded the request, 0 if it collects for another one */
+static uint16_t waveform_received;				/* One bit per chunk */
+static uint8_t waveform_retries;
+static uint8_t waveform_done;
+
+static uint8_t command_seq;
+static uint8_t next_transfer_id;
+static capture_cmd_t pending_cmd;				/* Latest command waiting for the rendezvous window */
+
+#define TICKS_TO_MS(t)	((unsigned long)(t) * 1000 / CLOCK_SECOND)
+
 
 /*----------------------------PACKET RECEIVE FUNCTIONS----------------------------_*/
 /*--------------------------------------------------------------------------------_*/
 
-/* Nothing to be done in case of broadcast_recv */
+/* Marks a mote as having sensed the train. The first report in a window is printed so the host can share it with other gateways. */
+static void mark_vibration(uint8_t index)
+{
+	if(index >= MAX_NO_OF_MOTES)
+		return;
+
+	if(vibration_array[index] == 0)
+	{
+		printf("\nReport Source ID = %d\n", index+1);
+	}
+	vibration_array[index] = 1;
+	last_report_time = clock_time();
+	pass_open = 1;
+}
+
+/* Local estimate of the network epoch clock */
+static uint32_t epoch_clock(void)
+{
+	return (uint32_t)clock_time() + epoch_offset + lut.epoch_hops * SLOT_HOP_LAG;
+}
+
+/* Routes are not needed on a gateway. Beacons are only checked for the epoch of a gateway with a lower ID, which all gateways
+   follow like the motes do, so every tree uses the same slots and rendezvous windows. */
 static void broadcast_recv(struct broadcast_conn *c, const linkaddr_t *from)
 {
-	 //printf("Broadcast message received from 0x%x%x: '%s' [RSSI %d]\n",from->u8[0], from->u8[1],(char *)packetbuf_dataptr(),(int16_t)packetbuf_attr(PACKETBUF_ATTR_RSSI));
+	l_table beacon;
+
+	if(packetbuf_datalen() != sizeof(l_table))
+		return;
+	packetbuf_copyto(&beacon);
+
+	if(beacon.epoch_sink < lut.epoch_sink || (beacon.epoch_sink == lut.epoch_sink && beacon.epoch_hops < lut.epoch_hops))
+	{
+		if(beacon.epoch_sink != lut.epoch_sink)
+		{
+			printf("\nEpoch of gateway 0x%x adopted.\n", beacon.epoch_sink);
+		}
+		lut.epoch_sink = beacon.epoch_sink;
+		lut.epoch_hops = beacon.epoch_hops + 1;
+		epoch_offset = beacon.sink_clock - (uint32_t)clock_time();
+		epoch_age = 0;
+	}
 }
 
 /* Unicast packet is saved, Source ID which initiated the packet and vibration value are parsed and saved. */
@@ -116,7 +282,233 @@ static void unicast_recv(struct unicast_conn *c, const linkaddr_t *from)
 	leds_on(LEDS_BLUE);
 	ctimer_set(&ctimer_unicast_LED, CLOCK_SECOND, callback_off, NULL);
 	rx_packet.source_id--;
-	vibration_array[rx_packet.source_id] = 1;
+	if(rx_packet.source_id >= MAX_NO_OF_MOTES)
+		return;
+	mark_vibration(rx_packet.source_id);
+
+	if(report_timing[rx_packet.source_id].rx_time == 0)
+	{
+		report_timing[rx_packet.source_id].rx_time = clock_time() | 1;		/* Never 0, which marks an empty entry */
+		report_timing[rx_packet.source_id].hop_count = rx_packet.hop_count;
+		report_timing[rx_packet.source_id].origin_delay = rx_packet.origin_delay;
+		report_timing[rx_packet.source_id].queue_delay = rx_packet.queue_delay;
+	}
+}
+
+
+/*-------------------------------WAVEFORM CAPTURE---------------------------------_*/
+/*--------------------------------------------------------------------------------_*/
+
+static void callback_capture_command(void *ptr)
+{
+	packetbuf_copyfrom(&pending_cmd, sizeof(capture_cmd_t));
+	broadcast_send(&captureConn);
+}
+
+/* Floods a command. In multi-channel mode the motes only hear it in the rendezvous window, so it may wait for the next one. */
+static void capture_command(uint8_t type, uint8_t target, uint8_t transfer_id, uint16_t missing)
+{
+	capture_cmd_t cmd = {type, 0, target, transfer_id, missing};
+	uint16_t phase = epoch_clock() % MC_RENDEZVOUS_PERIOD;
+
+	/* Motes drop a command with the same number as the last one, the low bits keep commands of different gateways apart */
+	cmd.seq = (uint8_t)((++command_seq << 3) | (gateway_index & 0x07));
+	pending_cmd = cmd;
+
+	if(MULTI_CHANNEL && phase >= MC_RENDEZVOUS_TICKS * 3 / 4)
+	{
+		ctimer_set(&ctimer_capture_command, MC_RENDEZVOUS_PERIOD - phase + 1, callback_capture_command, NULL);
+	}
+	else
+	{
+		callback_capture_command(NULL);
+	}
+}
+
+/* Expands one chunk into the waveform buffer. Returns 0 if it is malformed. */
+static uint8_t capture_decode(const capture_chunk_t *chunk)
+{
+	uint16_t *sample = &waveform[chunk->index * CAPTURE_CHUNK_SAMPLES];
+	uint8_t pos = 2;
+
+	if(chunk->index >= CAPTURE_CHUNKS || chunk->length < 2 || chunk->length > CAPTURE_CHUNK_BYTES)
+		return 0;
+
+	sample[0] = chunk->data[0] | (chunk->data[1] << 8);
+
+	for(int i = 1; i < CAPTURE_CHUNK_SAMPLES; i++)
+	{
+		if(pos >= chunk->length)
+			return 0;
+
+		if((int8_t)chunk->data[pos] == CAPTURE_DELTA_ESCAPE)
+		{
+			if(pos + 3 > chunk->length)
+				return 0;
+			sample[i] = chunk->data[pos+1] | (chunk->data[pos+2] << 8);
+			pos += 3;
+		}
+		else
+		{
+			sample[i] = sample[i-1] + (int8_t)chunk->data[pos];
+			pos += 1;
+		}
+	}
+
+	return 1;
+}
+
+/* Prints the complete waveform, one chunk per line, for Qt Display */
+static void capture_print(void)
+{
+	printf("\nWaveform Source ID = %d   Samples = %d\n", waveform_source, CAPTURE_SAMPLES);
+
+	for(int c = 0; c < CAPTURE_CHUNKS; c++)
+	{
+		printf("Waveform Data =");
+		for(int i = 0; i < CAPTURE_CHUNK_SAMPLES; i++)
+		{
+			printf(" %u", waveform[c * CAPTURE_CHUNK_SAMPLES + i]);
+		}
+		printf("\n");
+	}
+
+	printf("Waveform Complete Source ID = %d   Transfer = %d\n", waveform_source, waveform_transfer);
+}
+
+static void bulk_recv(struct unicast_conn *c, const linkaddr_t *from)
+{
+	capture_chunk_t chunk;
+
+	if(packetbuf_datalen() > sizeof(capture_chunk_t))
+		return;
+	memset(&chunk, 0, sizeof(chunk));
+	packetbuf_copyto(&chunk);
+
+	if(waveform_source == 0 || chunk.source_id != waveform_source || chunk.transfer_id != waveform_transfer)
+		return;									/* Not the requested transfer, e.g. a stale chunk still held by a relay */
+
+	if(waveform_done || !capture_decode(&chunk))
+		return;
+
+	waveform_received |= 1U << chunk.index;
+
+	if(waveform_received == CAPTURE_ALL_CHUNKS)
+	{
+		waveform_done = 1;
+		ctimer_stop(&ctimer_capture_timeout);
+		capture_print();
+		capture_command(CAPTURE_NACK, waveform_source, waveform_transfer, 0);		/* Nothing missing, mote can free its buffer */
+	}
+	else
+	{
+		ctimer_set(&ctimer_capture_timeout, CAPTURE_NACK_TIMEOUT, callback_capture_timeout, NULL);
+	}
+}
+
+/* Starts a transfer. The timeout runs from the request, so a lost request or a lost first chunk is retried too. */
+static void capture_request(uint8_t source_id)
+{
+	waveform_source = source_id;
+	waveform_transfer = ++next_transfer_id;
+	waveform_received = 0;
+	waveform_retries = 0;
+	waveform_done = 0;
+	waveform_requested = 1;
+
+	printf("\nWaveform Requested Source ID = %d   Transfer = %d\n", source_id, waveform_transfer);
+	capture_command(CAPTURE_REQUEST, waveform_source, waveform_transfer, 0);
+	ctimer_set(&ctimer_capture_timeout, CAPTURE_REQUEST_TIMEOUT, callback_capture_timeout, NULL);
+}
+
+/* Another gateway flooded a request. The mote may route its chunks here, the timeout starts with the first one. */
+static void capture_peer_request(uint8_t source_id, uint8_t transfer_id)
+{
+	ctimer_stop(&ctimer_capture_timeout);
+	waveform_source = source_id;
+	waveform_transfer = transfer_id;
+	waveform_received = 0;
+	waveform_retries = 0;
+	waveform_done = 0;
+	waveform_requested = 0;
+	next_transfer_id = transfer_id;				/* Own requests continue after it, so a mote never sees an ID twice */
+}
+
+/* Another gateway received all chunks of our request, so nothing is missing and the request must not be repeated */
+static void capture_peer_complete(uint8_t source_id, uint8_t transfer_id)
+{
+	if(!waveform_requested || waveform_done || source_id != waveform_source || transfer_id != waveform_transfer)
+		return;
+
+	waveform_done = 1;
+	ctimer_stop(&ctimer_capture_timeout);
+	printf("\nWaveform capture %d: collected by another gateway\n", waveform_transfer);
+}
+
+static void callback_capture_timeout(void *ptr)
+{
+	if(++waveform_retries > CAPTURE_MAX_RETRIES)
+	{
+		waveform_done = 1;
+		printf("\nWaveform Failed Source ID = %d   Transfer = %d\n", waveform_source, waveform_transfer);
+		capture_command(CAPTURE_NACK, waveform_source, waveform_transfer, 0);
+		return;
+	}
+
+	if(waveform_received == 0)					/* Nothing arrived, the request itself may have been lost */
+	{
+		printf("\nWaveform capture %d: requesting again\n", waveform_transfer);
+		capture_command(CAPTURE_REQUEST, waveform_source, waveform_transfer, 0);
+		ctimer_set(&ctimer_capture_timeout, CAPTURE_REQUEST_TIMEOUT, callback_capture_timeout, NULL);
+		return;
+	}
+
+	printf("\nWaveform capture %d: requesting missing chunks 0x%x\n", waveform_transfer, CAPTURE_ALL_CHUNKS & ~waveform_received);
+	capture_command(CAPTURE_NACK, waveform_source, waveform_transfer, CAPTURE_ALL_CHUNKS & ~waveform_received);
+	ctimer_set(&ctimer_capture_timeout, CAPTURE_NACK_TIMEOUT, callback_capture_timeout, NULL);
+}
+
+
+/*--------------------------------MULTI-CHANNEL-----------------------------------_*/
+/*--------------------------------------------------------------------------------_*/
+
+static void beacon_send(void *ptr)
+{
+	if(lut.epoch_sink != lut.sink && ++epoch_age > EPOCH_MAX_AGE)		/* The other gateway is gone, fall back to the own clock */
+	{
+		printf("\nEpoch of gateway 0x%x lost.\n", lut.epoch_sink);
+		lut.epoch_sink = lut.sink;
+		lut.epoch_hops = 0;
+		epoch_offset = 0;
+	}
+
+	lut.sink_clock = (uint32_t)clock_time() + epoch_offset;				/* Epoch for the report slots and rendezvous windows */
+	packetbuf_copyfrom(&lut, sizeof(l_table));
+	broadcast_send(&broadcastConn);
+}
+
+/* Everybody meets on CHANNEL at the start of each period of the epoch clock, otherwise the gateway listens on its home channel.
+   Once every MC_DISCOVERY_PERIODS it stays on CHANNEL for the whole period, to hear trees that still follow another gateway. */
+static void callback_rendezvous(void *ptr)
+{
+	uint32_t now = epoch_clock();
+	uint16_t phase = now % MC_RENDEZVOUS_PERIOD;
+	uint8_t discovery = (now / MC_RENDEZVOUS_PERIOD) % MC_DISCOVERY_PERIODS == (gateway_index + 1) % MC_DISCOVERY_PERIODS;
+
+	NETSTACK_CONF_RADIO.set_value(RADIO_PARAM_CHANNEL, (phase < MC_RENDEZVOUS_TICKS || discovery) ? CHANNEL : MC_HOME_CHANNEL(gateway_index + 1));
+
+	if(phase < MC_RENDEZVOUS_TICKS)
+	{
+		if(phase < MC_RENDEZVOUS_TICKS / 4)
+		{
+			ctimer_set(&ctimer_beacon, 1 + random_rand() % (MC_RENDEZVOUS_TICKS / 4), beacon_send, NULL);
+		}
+		ctimer_set(&ctimer_rendezvous, MC_RENDEZVOUS_TICKS - phase, callback_rendezvous, NULL);
+	}
+	else
+	{
+		ctimer_set(&ctimer_rendezvous, MC_RENDEZVOUS_PERIOD - phase, callback_rendezvous, NULL);
+	}
 }
 
 
@@ -129,27 +521,93 @@ AUTOSTART_PROCESSES(&gateway_main_process);
 PROCESS_THREAD(gateway_main_process, ev, data)
 {
 	static struct etimer etimer_broadcast;								/* For 10s delay in broadcasting the LUT */
-	PROCESS_EXITHANDLER( broadcast_close(&broadcastConn); unicast_close(&unicast); )
+	PROCESS_EXITHANDLER( broadcast_close(&broadcastConn); unicast_close(&unicast); broadcast_close(&captureConn); unicast_close(&bulk); )
 	PROCESS_BEGIN();
 
-	NETSTACK_CONF_RADIO.set_value(RADIO_PARAM_CHANNEL,  16);			/* Group No: 6 */
-	NETSTACK_CONF_RADIO.set_value(RADIO_PARAM_TXPOWER, -24);			/* Setting minimum power to limit the range to emulate multi-hops */
+	NETSTACK_CONF_RADIO.set_value(RADIO_PARAM_CHANNEL,  CHANNEL);		/* Group No: 6 */
+	NETSTACK_CONF_RADIO.set_value(RADIO_PARAM_TXPOWER, TX_POWER);		/* Setting minimum power to limit the range to emulate multi-hops */
+#ifndef CONTIKI_TARGET_COOJA
 	adc_zoul.configure(SENSORS_HW_INIT, ZOUL_SENSORS_ADC1);
+#endif
+
+	gateway_index = linkaddr_node_addr.u8[1] - 1;
+	lut.next_hop.u8[1] = linkaddr_node_addr.u8[1];						/* Every gateway is a sink, motes route to the cheapest one */
+	lut.sink = linkaddr_node_addr.u8[1];
+	lut.epoch_sink = lut.sink;											/* Until a gateway with a lower ID is heard */
 
 	broadcast_open(&broadcastConn, 125, &broadcast_callbacks);
 	unicast_open(&unicast, 129, &unicast_call);
+	broadcast_open(&captureConn, 127, &capture_callbacks);
+	unicast_open(&bulk, 131, &bulk_call);
+
+	command_seq = random_rand();												/* Motes must not mistake commands after a reboot for old ones */
+	next_transfer_id = random_rand();
 
 	ctimer_set(&ctimer_array_processing, CLOCK_SECOND*60, callback_array_processing, NULL);		/* Detecting algorithm is done every 60 seconds */
 	etimer_set(&etimer_broadcast, CLOCK_SECOND*10+ 0.1*random_rand()/RANDOM_RAND_MAX);			/* Broadcast is done every 10 seconds */
+	if(MULTI_CHANNEL)
+	{
+		ctimer_set(&ctimer_rendezvous, 1, callback_rendezvous, NULL);							/* Broadcast is done in every rendezvous window instead */
+	}
 	ctimer_set(&ctimer_vibration_sensing, CLOCK_SECOND, callback_vibration, NULL);				/* Vibrations are sensed every second */
 
 	while(1)
 	{
-        PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&etimer_broadcast));
+        PROCESS_WAIT_EVENT();
+
+		if(ev == serial_line_event_message)
+		{
+			if(strncmp((const char *)data, PEER_REPORT_PREFIX, strlen(PEER_REPORT_PREFIX)) == 0)
+			{
+				int source_id = atoi((const char *)data + strlen(PEER_REPORT_PREFIX));
+				if(source_id >= 1 && source_id <= MAX_NO_OF_MOTES)
+				{
+					vibration_array[source_id - 1] = 1;					/* Not printed again, it already came from a gateway */
+					last_report_time = clock_time();
+					pass_open = 1;
+				}
+			}
+
+			else if(strncmp((const char *)data, CAPTURE_PREFIX, strlen(CAPTURE_PREFIX)) == 0)
+			{
+				int source_id = atoi((const char *)data + strlen(CAPTURE_PREFIX));
+				if(source_id >= 1 && source_id <= MAX_NO_OF_MOTES && source_id != gateway_index + 1)
+				{
+					capture_request(source_id);
+				}
+			}
+
+			else if(strncmp((const char *)data, PEER_CAPTURE_PREFIX, strlen(PEER_CAPTURE_PREFIX)) == 0)
+			{
+				int source_id = atoi((const char *)data + strlen(PEER_CAPTURE_PREFIX));
+				const char *transfer = strstr((const char *)data, TRANSFER_KEY);
+				if(transfer != NULL && source_id >= 1 && source_id <= MAX_NO_OF_MOTES)
+				{
+					capture_peer_request(source_id, atoi(transfer + strlen(TRANSFER_KEY)));
+				}
+			}
+
+			else if(strncmp((const char *)data, PEER_COMPLETE_PREFIX, strlen(PEER_COMPLETE_PREFIX)) == 0)
+			{
+				int source_id = atoi((const char *)data + strlen(PEER_COMPLETE_PREFIX));
+				const char *transfer = strstr((const char *)data, TRANSFER_KEY);
+				if(transfer != NULL && source_id >= 1 && source_id <= MAX_NO_OF_MOTES)
+				{
+					capture_peer_complete(source_id, atoi(transfer + strlen(TRANSFER_KEY)));
+				}
+			}
+
+			else if(strcmp((const char *)data, TRAIN_PASS_LINE) == 0)
+			{
+				mark_vibration(gateway_index);							/* Injected train pass, for simulations and bench tests */
+			}
+		}
 
-		packetbuf_copyfrom(&lut, sizeof(l_table));
-		broadcast_send(&broadcastConn);
-    	etimer_reset(&etimer_broadcast);
+		else if(!MULTI_CHANNEL && etimer_expired(&etimer_broadcast))
+		{
+			beacon_send(NULL);
+	    	etimer_reset(&etimer_broadcast);
+		}
 	}
 
 	PROCESS_END();
@@ -160,10 +618,23 @@ PROCESS_THREAD(gateway_main_process, ev, data)
 
 /*-----------------------BREAKAGE DETECTION ALGORITHM-----------------------------_*/
 
+/* The window is held while a train pass is still reporting. Gateway clocks are not aligned, so a fixed
+   60s cut could split one pass on one gateway only and the boundary sections would see false mismatches. */
 static void callback_array_processing(void *ptr)
 {
+	static uint8_t holds = 0;
 	uint8_t sum = 0;
-	uint8_t health_status_array[MAX_NO_OF_MOTES - 2] = {0};				/* Binary array to store health status for each section of the track */
+	clock_time_t since_report = clock_time() - last_report_time;
+
+	if(pass_open && since_report < PASS_QUIET_TICKS && holds < PASS_MAX_HOLDS)
+	{
+		holds++;
+		ctimer_set(&ctimer_array_processing, PASS_QUIET_TICKS - since_report, callback_array_processing, NULL);
+		return;
+	}
+	pass_open = 0;
+	holds = 0;
+
 	printf("\nUpdating the status of the track. \nProcessing started:");
 
 /*--------------------------------------------------------------------------------_*/
@@ -196,11 +667,20 @@ static void callback_array_processing(void *ptr)
 
 	for(int i=0; i<MAX_NO_OF_MOTES - 2; i++)
 	{
-		if(vibration_array[i] - vibration_array[i+2] != 0)				/* Comparing vibrations of 2 consecutive motes to detect breakage */
+		if(!OWNS_TRACK(i+2))											/* Section belongs to another gateway */
+		{
+			continue;
+		}
+
+		if(sum > 0)														/* Only a train pass carries evidence about the track */
+		{
+			health_update(&health[i], &health_params, vibration_array[i] != vibration_array[i+2]);	/* Comparing vibrations of 2 consecutive motes to detect breakage */
+		}
+
+		if(health[i].alarm == 1)
 		{
 			printf("\nBreakage Detected!\n");
 			printf("\nFaulted Track ID = %d\n", i+2);					/* For Qt Display */
-			health_status_array[i] = 1;	/* Index 0 means Track ID 2 */
 		}
 	}
 
@@ -211,13 +691,27 @@ static void callback_array_processing(void *ptr)
 
 	for(int i = 0; i < MAX_NO_OF_MOTES - 2; i++)
 	{
-		printf("\nTrack ID = %d   Health Status = %s",i+2, (health_status_array[i] == 1) ? "FAULTY" : "HEALTHY");
+		if(!OWNS_TRACK(i+2))
+			continue;
+		printf("\nTrack ID = %d   Health Status = %s   Confidence = %d",i+2, (health[i].alarm == 1) ? "FAULTY" : "HEALTHY", health_confidence(&health[i], &health_params));
 	}
 
 	printf("\n");
 /*------Now we have identified exactly which section of the track is broken.-----_*/
 /*-------------------------------------------------------------------------------_*/
 
+	clock_time_t now = clock_time();
+
+	for(int i = 0; i < MAX_NO_OF_MOTES; i++)		/* Per-stage delays of the reports that fed this window, for Qt Display */
+	{
+		if(report_timing[i].rx_time != 0)
+		{
+			printf("\nLatency Source ID = %d   Hops = %d   Origin = %lu   Relay = %lu   Batch = %lu\n", i+1, report_timing[i].hop_count,
+					TICKS_TO_MS(report_timing[i].origin_delay), TICKS_TO_MS(report_timing[i].queue_delay), TICKS_TO_MS(now - report_timing[i].rx_time));
+			report_timing[i].rx_time = 0;
+		}
+	}
+
 	printf("\nProcessing Completed. \n");
 
 	for(int j = 0; j<MAX_NO_OF_MOTES; j++)
@@ -226,7 +720,7 @@ static void callback_array_processing(void *ptr)
 	}
 
 	printf("\nArray has been re-initialized.\n");
-	ctimer_reset(&ctimer_array_processing);
+	ctimer_set(&ctimer_array_processing, CLOCK_SECOND*60, callback_array_processing, NULL);	/* Restarted, the window may have been held for a pass */
 }
 
 /*--------------------------------------------------------------------------------_*/
@@ -243,13 +737,13 @@ static void callback_vibration(void *ptr)
 	uint16_t adc1_value = 1000;
 	static uint16_t avg_adc1_value = 1000;
 
-	adc1_value = adc_zoul.value(ZOUL_SENSORS_ADC1) >> 4;
+	adc1_value = ADC1_VALUE();
 	avg_adc1_value = (avg_adc1_value + adc1_value) / 2;
 
 	if(avg_adc1_value >1200 || avg_adc1_value< 900 )
 	{
 		printf("\nVibration Detected");
-	    vibration_array[MAX_NO_OF_MOTES-1] = 1;						/* If gateway has sensed vibrations, vibration_value is set to true for gateway */
+	    mark_vibration(gateway_index);									/* If gateway has sensed vibrations, vibration_value is set to true for gateway */
 	    leds_on(LEDS_YELLOW);
 	    ctimer_set(&ctimer_vibration_LED, CLOCK_SECOND, callback_off, NULL);
 	}
@@ -1,13 +1,16 @@
 #ifndef PROJECT_CONF_H_
 #define PROJECT_CONF_H_
 
+// Shared by the motes and the gateway, the gateway Makefile includes this file as its PROJECT_CONF_H
 
 // PHY LAYER PARAMETERS
 #define CHANNEL 16
 #define TX_POWER -24
 
 #define MAX_RSSI -35
-#define MAX_NO_OF_MOTES	6
+#ifndef MAX_NO_OF_MOTES
+#define MAX_NO_OF_MOTES	6		/* Highest mote ID on the line, gateways included */
+#endif
 
 // MAC LAYER PARAMETERS
 //#define NETSTACK_CONF_MAC nullmac_driver
@@ -18,6 +21,38 @@
 
 //#define NETSTACK_CONF_RDC_CHANNEL_CHECK_RATE 4
 
+// SLOTTED REPORTING
+// 1: vibration reports wait for a per-mote slot in a frame synchronised by the LUT beacons, 0: send at once
+// The frame follows one epoch for the whole network, the clock of the lowest gateway ID.
+#ifndef SLOTTED_REPORTS
+#define SLOTTED_REPORTS 0
+#endif
+#define EPOCH_SECOND (CLOCK_SECOND >= 768 ? 1024 : CLOCK_SECOND >= 384 ? 512 : CLOCK_SECOND >= 192 ? 256 : 128)
+												// CLOCK_SECOND rounded to a power of two ticks (128 on the Zoul, 1024 in Cooja),
+												// so frames and periods built from it divide the 32-bit epoch clock on every target
+#define SLOT_TICKS (EPOCH_SECOND/4)				// Long enough for a report to cross a few hops
+#define SLOT_FRAME_SLOTS 8						// Power of two, more than twice the radio reach in mote IDs
+#define SLOT_GUARD_TICKS (SLOT_TICKS/8)			// Sending starts this far into the slot to absorb sync errors
+#define SLOT_HOP_LAG (CLOCK_SECOND/16)			// Expected delay of a beacon on one hop, the epoch lags by this per hop
+
+// MULTI-CHANNEL
+// 1: every mote listens on the channel of its hop group, CHANNEL is only the rendezvous channel for beacons
+// and capture commands. Uses the epoch of the slot frame above.
+#ifndef MULTI_CHANNEL
+#define MULTI_CHANNEL 0
+#endif
+#define MC_FIRST_CHANNEL 17						// Data channels MC_FIRST_CHANNEL .. MC_FIRST_CHANNEL + MC_CHANNELS - 1
+#define MC_CHANNELS 3							// Adjacent groups always differ with 3 or more
+#define MC_GROUP_SIZE 2							// Motes with consecutive IDs sharing one channel
+#define MC_RENDEZVOUS_PERIOD (EPOCH_SECOND*8)	// Power of two ticks, replaces the 10 s beacon period
+#define MC_RENDEZVOUS_TICKS (EPOCH_SECOND/2)	// Everybody is on CHANNEL for this long at the start of each period
+#define MC_HOME_CHANNEL(id) (MC_FIRST_CHANNEL + (((id) - 1) / MC_GROUP_SIZE) % MC_CHANNELS)	// Channel a mote listens on
+#define MC_DISCOVERY_PERIODS 16					// Every mote spends one period in this many on CHANNEL, power of two
+#define EPOCH_MAX_AGE 30						// Beacons without a refresh from closer to the epoch gateway before the epoch is dropped
+
+// SIMULATION
+// A line written to the serial port of a mote or gateway that stands in for a detected train, see Simulation/
+#define TRAIN_PASS_LINE "Train Pass"
 
 
 #endif /* PROJECT_CONF_H_ */
@@ -37,13 +37,12 @@
 #include "dev/button-sensor.h" // User Button
 #include "dev/leds.h"          // Use LEDs.
 #include "core/net/linkaddr.h"
-#include "dev/adc-zoul.h"      // ADC
-#include "dev/zoul-sensors.h"  // Sensor functions
+#include "dev/serial-line.h"   // Injected train passes
 // Standard C includes:
 #include <stdio.h>
+#include <string.h>
 #include "sys/ctimer.h"
 #include "sys/etimer.h"
-#include "dev/cc2538-rf.h"
 #include <math.h>
 #include "lib/random.h"
 #include "sys/clock.h"
@@ -51,6 +50,19 @@
 #include <stdbool.h>
 #include "project-conf.h"
 
+#ifdef CONTIKI_TARGET_COOJA				// Simulation: no ADC or supply sensor, trains are injected with TRAIN_PASS_LINE
+#define ADC1_VALUE()		1000
+#define BATTERY_VALUE()		100
+#define BUTTON_PRESSED()	1
+#else
+#include "dev/adc-zoul.h"      // ADC
+#include "dev/zoul-sensors.h"  // Sensor functions
+#include "dev/cc2538-rf.h"
+#define ADC1_VALUE()		(adc_zoul.value(ZOUL_SENSORS_ADC1) >> 4)
+#define BATTERY_VALUE()		(vdd3_sensor.value(CC2538_SENSORS_VALUE_TYPE_CONVERTED) / 40)
+#define BUTTON_PRESSED()	(button_sensor.value(BUTTON_SENSOR_VALUE_TYPE_LEVEL) == BUTTON_SENSOR_PRESSED_LEVEL)
+#endif
+
 /*---------------------------------------------------------------------------------*/
 
 /*--------------------------TIMER DECLARATIONS-------------------------------------*/
@@ -58,6 +70,7 @@
 
 static void callback_broadcast(void *ptr);
 static void callback_sensor(void *ptr);
+static void report_vibration(uint16_t value);
 static void callback_LUT_reset(void *ptr);
 static void callback_off(void *ptr);
 
@@ -66,6 +79,21 @@ static struct ctimer timer_sensor;					// To sense vibrations every 5 seconds
 static struct ctimer timer_LUT_reset;				// To avoid faulty motes, LUT is reset every 2 minutes
 static struct ctimer ctimer_unicast_LED, ctimer_vibration_detected_LED;						// For LED blinking
 
+static void callback_capture_sample(void *ptr);
+static void callback_capture_chunk(void *ptr);
+static void callback_flood(void *ptr);
+static void callback_slot_send(void *ptr);
+static void callback_relay(void *ptr);
+static clock_time_t slot_delay(void);
+
+static struct ctimer timer_capture;				// Paces ADC samples while recording, then chunks while sending
+static struct ctimer timer_flood;				// Random delay before a capture command is rebroadcast
+static struct ctimer timer_slot;				// Holds a vibration report until the slot of this mote
+static struct ctimer timer_relay;				// Releases relayed waveform chunks once vibration reports are through
+
+static void callback_rendezvous(void *ptr);
+static struct ctimer timer_rendezvous;			// Opens and closes the rendezvous window in multi-channel mode
+
 /*--------------------------------------------------------------------------------_*/
 /*--------------------------------------------------------------------------------_*/
 
@@ -78,12 +106,18 @@ typedef struct
 	linkaddr_t 	next_hop;			/* Next hop in route to destination. */
 	uint16_t 	cost;
 	uint16_t 	battery;
+	uint8_t		sink;				/* Gateway the route leads to, several gateways can share the network */
+	uint8_t		epoch_sink;			/* Gateway whose clock is the network epoch, the lowest ID heard; EPOCH_NONE if unknown */
+	uint8_t		epoch_hops;			/* Hops from the sender to epoch_sink */
+	uint32_t	sink_clock;			/* Sender's estimate of the epoch_sink clock, defines the slot frame and rendezvous windows */
 }l_table;
 
+#define EPOCH_NONE			0xFF			/* No gateway clock learned yet */
+
 /*--------------------------------------------------------------------------------_*/
 static l_table lut =
 {
-	.next_hop.u8[1] = 0x08, .cost= 10000, .battery=100,
+	.next_hop.u8[1] = 0x08, .cost= 10000, .battery=100, .sink = 0, .epoch_sink = EPOCH_NONE, .epoch_hops = EPOCH_NONE,
 };
 
 /*--------------------------------------------------------------------------------_*/
@@ -91,11 +125,94 @@ typedef struct
 {
 	uint8_t source_id;
 	uint16_t vibration_value;
+	uint8_t hop_count;				/* Number of relays the report has passed */
+	uint16_t origin_delay;			/* Ticks from the ADC sample until the source's MAC has sent it */
+	uint16_t queue_delay;			/* Ticks spent inside relays and their MACs, summed over all hops */
 }packet_t;
 
 l_table receive_message;
 packet_t tx_packet;
 
+static clock_time_t last_report_time;			/* Last vibration report sent or forwarded, bulk transfers yield to them */
+
+#define MAC_HANDOFFS	8						/* Unicasts in the MAC queue whose hand-off time is kept */
+
+static clock_time_t mac_handoff[MAC_HANDOFFS];	/* Hand-off times in sending order, the MAC reports them back in that order */
+static uint8_t mac_handoff_head, mac_handoff_count;
+static uint16_t mac_delay;						/* Mean ticks from hand-off to the MAC's sent callback, measured on recent unicasts */
+
+#define SLOT_FRAME_TICKS	(SLOT_TICKS * SLOT_FRAME_SLOTS)	/* Must divide 2^32, the sink clock is 32 bits */
+
+#if (SLOT_FRAME_TICKS & (SLOT_FRAME_TICKS - 1)) != 0
+#error "SLOT_FRAME_TICKS must be a power of two, or the slot phase jumps when the epoch clock wraps"
+#endif
+#if ((MC_RENDEZVOUS_PERIOD * MC_DISCOVERY_PERIODS) & (MC_RENDEZVOUS_PERIOD * MC_DISCOVERY_PERIODS - 1)) != 0
+#error "MC_RENDEZVOUS_PERIOD and MC_DISCOVERY_PERIODS must be powers of two, or discovery periods are skipped when the epoch clock wraps"
+#endif
+
+static uint32_t sink_clock_offset;				/* Epoch sink clock minus local clock, learned from the neighbour closest to it */
+static bool slot_synced = false;
+static uint8_t epoch_age;						/* Beacons sent since the epoch was last refreshed */
+
+/*-------------------------------MULTI-CHANNEL------------------------------------_*/
+/*--------------------------------------------------------------------------------_*/
+
+static uint8_t tx_pending = 0;					/* Unicasts handed to the MAC, the radio stays on their channel meanwhile */
+static int radio_channel = CHANNEL;
+static clock_time_t sample_time;				/* ADC sample time of the report waiting in tx_packet */
+
+/*-----------------------------WAVEFORM CAPTURE-----------------------------------_*/
+/*--------------------------------------------------------------------------------_*/
+
+#define CAPTURE_SAMPLES			256									/* 2 s of raw ADC at one sample per clock tick */
+#define CAPTURE_CHUNK_SAMPLES	16
+#define CAPTURE_CHUNKS			(CAPTURE_SAMPLES / CAPTURE_CHUNK_SAMPLES)	/* At most 16, one bit each in the NACK mask */
+#define CAPTURE_ALL_CHUNKS		((uint16_t)((1UL << CAPTURE_CHUNKS) - 1))
+#define CAPTURE_CHUNK_BYTES		48									/* Worst case: 2 bytes + 15 escaped deltas of 3 bytes */
+#define CAPTURE_DELTA_ESCAPE	((int8_t)-128)						/* Delta out of range, the absolute sample follows */
+#define CAPTURE_CHUNK_INTERVAL	(CLOCK_SECOND/4)					/* Rate limit of the bulk transfer at the source */
+#define CAPTURE_YIELD_TICKS		(CLOCK_SECOND)						/* Chunks wait this long after any vibration report */
+#define CAPTURE_RELAY_SLOTS		4									/* Relayed chunks held back while reports are on the air */
+
+#define CAPTURE_REQUEST			1
+#define CAPTURE_NACK			2
+
+/*! Command from a gateway, flooded over the whole network */
+typedef struct
+{
+	uint8_t type;					/* CAPTURE_REQUEST or CAPTURE_NACK */
+	uint8_t seq;					/* Flood sequence number, every mote rebroadcasts a command once */
+	uint8_t target;					/* Mote ID that has to act on the command */
+	uint8_t transfer_id;
+	uint16_t missing;				/* NACK: chunks to send again, 0 ends the transfer */
+}capture_cmd_t;
+
+/*! One fragment of a waveform, routed to the gateway like a vibration report */
+typedef struct
+{
+	uint8_t source_id;
+	uint8_t transfer_id;
+	uint8_t index;					/* Chunk number, samples index*CAPTURE_CHUNK_SAMPLES onwards */
+	uint8_t length;					/* Used bytes of data */
+	uint8_t data[CAPTURE_CHUNK_BYTES];	/* First sample little endian, then 1-byte deltas */
+}capture_chunk_t;
+
+enum { CAPTURE_IDLE, CAPTURE_RECORDING, CAPTURE_SENDING, CAPTURE_DONE };
+
+static uint16_t capture_buffer[CAPTURE_SAMPLES];
+static uint16_t capture_length;
+static uint8_t capture_state = CAPTURE_IDLE;
+static uint8_t capture_transfer_id;
+static uint16_t capture_pending;				/* Chunks still to be sent */
+
+static capture_chunk_t relay_chunk[CAPTURE_RELAY_SLOTS];	/* Chunks of other motes waiting to be forwarded, oldest at relay_head */
+static uint8_t relay_length[CAPTURE_RELAY_SLOTS];
+static uint8_t relay_head, relay_count;
+
+static capture_cmd_t flood_cmd;					/* Command waiting to be rebroadcast */
+static uint8_t last_command_seq;
+static bool command_seen = false;
+
 /*---------------------PACKET RECEIVE FUNCTIONS DECLARATION-----------------------_*/
 /*--------------------------------------------------------------------------------_*/
 
@@ -105,7 +222,116 @@ static const struct broadcast_callbacks broadcast_callbacks = {broadcast_recv};
 
 static void unicast_recv(struct unicast_conn *c, const linkaddr_t *from);
 static struct unicast_conn unicast;
-static const struct unicast_callbacks unicast_call = {unicast_recv};
+static void unicast_sent(struct unicast_conn *c, int status, int num_tx);
+static const struct unicast_callbacks unicast_call = {unicast_recv, unicast_sent};
+
+static void capture_recv(struct broadcast_conn *c, const linkaddr_t *from);
+static struct broadcast_conn captureConn;
+static const struct broadcast_callbacks capture_callbacks = {capture_recv};
+
+static void bulk_recv(struct unicast_conn *c, const linkaddr_t *from);
+static struct unicast_conn bulk;
+static const struct unicast_callbacks bulk_call = {bulk_recv, unicast_sent};
+
+/*---------------------------CHANNEL SELECTION------------------------------------_*/
+/*--------------------------------------------------------------------------------_*/
+
+static void set_channel(int channel)
+{
+	if(channel != radio_channel)
+	{
+		NETSTACK_CONF_RADIO.set_value(RADIO_PARAM_CHANNEL, channel);
+		radio_channel = channel;
+	}
+}
+
+static uint32_t epoch_clock(void)				/* Local estimate of the epoch sink clock */
+{
+	return (uint32_t)clock_time() + sink_clock_offset + lut.epoch_hops * SLOT_HOP_LAG;
+}
+
+static uint16_t rendezvous_phase(void)			/* Ticks since the start of the current rendezvous period */
+{
+	return epoch_clock() % MC_RENDEZVOUS_PERIOD;
+}
+
+/* Channel mote `id` listens on right now. Once every MC_DISCOVERY_PERIODS each mote stays on CHANNEL for a
+   whole period, so it also hears beacons of neighbours whose windows still follow another gateway. */
+static int listen_channel(uint8_t id)
+{
+	uint32_t now = epoch_clock();
+
+	if(!slot_synced || now % MC_RENDEZVOUS_PERIOD < MC_RENDEZVOUS_TICKS || (now / MC_RENDEZVOUS_PERIOD) % MC_DISCOVERY_PERIODS == id % MC_DISCOVERY_PERIODS)
+		return CHANNEL;
+
+	return MC_HOME_CHANNEL(id);
+}
+
+/* Ticks to wait before a broadcast reaches everybody on the rendezvous channel, 0 if it can go now */
+static clock_time_t rendezvous_wait(void)
+{
+	uint16_t phase = rendezvous_phase();
+
+	if(!MULTI_CHANNEL || !slot_synced || phase < MC_RENDEZVOUS_TICKS * 3 / 4)
+		return 0;
+
+	return MC_RENDEZVOUS_PERIOD - phase + 1 + random_rand() % (MC_RENDEZVOUS_TICKS / 4);
+}
+
+static void radio_channel_update(void)			/* Listening channel for the current time, kept while a unicast is in flight */
+{
+	if(!MULTI_CHANNEL || tx_pending > 0)
+		return;
+
+	set_channel(listen_channel(node_address));
+}
+
+/* Sends packetbuf to the next hop, on the channel the next hop is listening on */
+static void route_send(struct unicast_conn *c)
+{
+	if(MULTI_CHANNEL)
+	{
+		set_channel(listen_channel(lut.next_hop.u8[1]));
+		tx_pending++;
+	}
+
+	if(mac_handoff_count == MAC_HANDOFFS)			/* A sent callback went missing, forget the oldest */
+	{
+		mac_handoff_head = (mac_handoff_head + 1) % MAC_HANDOFFS;
+		mac_handoff_count--;
+	}
+	mac_handoff[(mac_handoff_head + mac_handoff_count++) % MAC_HANDOFFS] = clock_time();
+
+	if(!unicast_send(c, &lut.next_hop))
+	{
+		mac_handoff_count--;
+		if(MULTI_CHANNEL)
+		{
+			tx_pending--;
+			radio_channel_update();
+		}
+	}
+}
+
+/* Called by the MAC once a unicast has left, after all its retransmissions */
+static void unicast_sent(struct unicast_conn *c, int status, int num_tx)
+{
+	if(mac_handoff_count > 0)
+	{
+		uint16_t sample = (uint16_t)(clock_time() - mac_handoff[mac_handoff_head]);
+
+		mac_handoff_head = (mac_handoff_head + 1) % MAC_HANDOFFS;
+		mac_handoff_count--;
+		mac_delay = (mac_delay == 0) ? sample : (uint16_t)((3UL * mac_delay + sample) / 4);	/* Moving average over about 4 sends */
+		printf("\nMAC sent: status %d, transmissions %d, delay %u ticks.\n", status, num_tx, sample);
+	}
+
+	if(MULTI_CHANNEL && tx_pending > 0)
+	{
+		tx_pending--;
+		radio_channel_update();
+	}
+}
 
 /*------------------PACKET RECEIVE FUMCTIONS DEFINITIONS--------------------------_*/
 /*--------------------------------------------------------------------------------_*/
@@ -113,18 +339,140 @@ static const struct unicast_callbacks unicast_call = {unicast_recv};
 static void unicast_recv(struct unicast_conn *c, const linkaddr_t *from)
 {
 	packet_t local_unicast_msg;
+	clock_time_t rx_time = clock_time();
 	printf("\nUnicast message received from 0x%x%x: [RSSI %d]\n",from->u8[0], from->u8[1],(int16_t)packetbuf_attr(PACKETBUF_ATTR_RSSI));
 
 	packetbuf_copyto(&local_unicast_msg);
 
 	printf("\nPacket forwarding to 0x%x with source ID: %d and vibration value: %d", lut.next_hop, local_unicast_msg.source_id, local_unicast_msg.vibration_value);
-	unicast_send(&unicast, &lut.next_hop);
+	local_unicast_msg.hop_count++;
+	local_unicast_msg.queue_delay += (uint16_t)(clock_time() - rx_time) + mac_delay;	/* Held here, then in the MAC. The MAC time of this very packet is only known once it has left. */
+	packetbuf_copyfrom(&local_unicast_msg, sizeof(packet_t));
+	route_send(&unicast);
+	last_report_time = clock_time();
 	printf("\nPacket Forwarded");
 
 	leds_on(LEDS_GREEN);
 	ctimer_set(&ctimer_unicast_LED, CLOCK_SECOND, callback_off, NULL);
 }
 
+/*--------------------------------------------------------------------------------_*/
+static void bulk_recv(struct unicast_conn *c, const linkaddr_t *from)	/* Waveform chunks are only relayed, unchanged */
+{
+	clock_time_t since_report = clock_time() - last_report_time;
+	uint8_t slot;
+
+	if(relay_count == 0 && since_report >= CAPTURE_YIELD_TICKS)
+	{
+		route_send(&bulk);
+		return;
+	}
+
+	if(relay_count == CAPTURE_RELAY_SLOTS || packetbuf_datalen() > sizeof(capture_chunk_t))
+	{
+		printf("\nWaveform chunk dropped, relay queue full.\n");		/* The gateway asks for it again */
+		return;
+	}
+
+	slot = (relay_head + relay_count++) % CAPTURE_RELAY_SLOTS;			/* Vibration reports have priority, hold it */
+	relay_length[slot] = packetbuf_datalen();
+	packetbuf_copyto(&relay_chunk[slot]);
+
+	if(ctimer_expired(&timer_relay))
+	{
+		ctimer_set(&timer_relay, (since_report < CAPTURE_YIELD_TICKS) ? CAPTURE_YIELD_TICKS - since_report : 1, callback_relay, NULL);
+	}
+}
+
+/*--------------------------------------------------------------------------------_*/
+static void capture_command(const capture_cmd_t *cmd)
+{
+	if(cmd->type == CAPTURE_REQUEST)
+	{
+		if(capture_state == CAPTURE_DONE && cmd->transfer_id == capture_transfer_id)
+		{
+			capture_pending = CAPTURE_ALL_CHUNKS;			/* Repeated request: none of the chunks arrived */
+			capture_state = CAPTURE_SENDING;
+			ctimer_set(&timer_capture, CAPTURE_CHUNK_INTERVAL, callback_capture_chunk, NULL);
+			return;
+		}
+
+		if(capture_state != CAPTURE_IDLE && cmd->transfer_id == capture_transfer_id)
+			return;										/* Already working on it */
+
+		printf("\nWaveform capture %d requested.\n", cmd->transfer_id);
+		capture_transfer_id = cmd->transfer_id;
+		capture_length = 0;
+		capture_pending = 0;
+		capture_state = CAPTURE_RECORDING;
+		ctimer_set(&timer_capture, 1, callback_capture_sample, NULL);
+	}
+
+	else if(cmd->type == CAPTURE_NACK && cmd->transfer_id == capture_transfer_id && capture_state != CAPTURE_RECORDING)
+	{
+		if(cmd->missing == 0)							/* Gateway has everything or gave up */
+		{
+			ctimer_stop(&timer_capture);
+			capture_state = CAPTURE_IDLE;
+			printf("\nWaveform capture %d finished.\n", cmd->transfer_id);
+			return;
+		}
+
+		capture_pending |= cmd->missing & CAPTURE_ALL_CHUNKS;
+		if(capture_state == CAPTURE_DONE)
+		{
+			capture_state = CAPTURE_SENDING;
+			ctimer_set(&timer_capture, CAPTURE_CHUNK_INTERVAL, callback_capture_chunk, NULL);
+		}
+	}
+}
+
+/*--------------------------------------------------------------------------------_*/
+static void capture_recv(struct broadcast_conn *c, const linkaddr_t *from)
+{
+	capture_cmd_t cmd;
+
+	if(packetbuf_datalen() != sizeof(capture_cmd_t))
+		return;
+	packetbuf_copyto(&cmd);
+
+	if(command_seen && cmd.seq == last_command_seq)		/* Already handled and rebroadcast */
+		return;
+	command_seen = true;
+	last_command_seq = cmd.seq;
+
+	if(cmd.target == node_address)
+	{
+		capture_command(&cmd);
+		return;
+	}
+
+	flood_cmd = cmd;
+	ctimer_set(&timer_flood, 1 + random_rand() % (CLOCK_SECOND/8), callback_flood, NULL);		/* Further delayed to the rendezvous window in multi-channel mode */
+}
+
+/*--------------------------------------------------------------------------------_*/
+/* One epoch for the whole network: the clock of the lowest gateway ID heard, taken from whichever neighbour is
+   fewer hops from that gateway. Several gateways would otherwise run their trees on unrelated windows. */
+static void epoch_update(const l_table *beacon)
+{
+	if(beacon->epoch_sink == EPOCH_NONE)
+		return;
+
+	if(beacon->epoch_sink < lut.epoch_sink || (beacon->epoch_sink == lut.epoch_sink && beacon->epoch_hops < lut.epoch_hops))
+	{
+		if(beacon->epoch_sink != lut.epoch_sink)
+		{
+			printf("\nEpoch of gateway 0x%x adopted.\n", beacon->epoch_sink);
+		}
+		lut.epoch_sink = beacon->epoch_sink;
+		lut.epoch_hops = beacon->epoch_hops + 1;
+		sink_clock_offset = beacon->sink_clock - (uint32_t)clock_time();
+		slot_synced = true;
+		epoch_age = 0;
+	}
+}
+
 /*--------------------------------------------------------------------------------_*/
 static void broadcast_recv(struct broadcast_conn *c, const linkaddr_t *from)
 {
@@ -133,13 +481,18 @@ static void broadcast_recv(struct broadcast_conn *c, const linkaddr_t *from)
 	bool LUT_update;
 
 	int addr = from->u8[1];
+	int reach = (node_address % 2 == 1) ? 2 : 3;				/* Emulated radio range in mote IDs */
 
+	if(addr < 1 || addr > MAX_NO_OF_MOTES)
+	{
+		return;
+	}
 
 	received_RSSI =(int16_t)packetbuf_attr(PACKETBUF_ATTR_RSSI);
 
 	RSSI_array[(from->u8[1]) - 1] = (RSSI_array[(from->u8[1])-1] + received_RSSI) / 2;			/* Moving Average Filter for RSSI */
 
-	if(((node_address % 2 == 1) && (addr < (node_address + 3))) || (node_address % 2 == 0 && addr <= (node_address + 3)))
+	if(addr <= node_address + reach && addr + reach >= node_address)		/* Neighbours on both sides, a gateway may sit at either end */
 	{
 		LUT_update = 1;
 	}
@@ -154,7 +507,15 @@ static void broadcast_recv(struct broadcast_conn *c, const linkaddr_t *from)
 		printf("\nBroadcast message received from 0x%x%x: [RSSI %d]\n", from->u8[0], from->u8[1], (int16_t)packetbuf_attr(PACKETBUF_ATTR_RSSI));
 
 		packetbuf_copyto(&receive_message);
-		printf("\nCost Received: %d\tBattery Value Received: %d", receive_message.cost, receive_message.battery);
+		printf("\nCost Received: %d\tBattery Value Received: %d\tSink: 0x%x", receive_message.cost, receive_message.battery, receive_message.sink);
+
+		epoch_update(&receive_message);							/* Also from neighbours routing through us */
+
+		if(receive_message.next_hop.u8[1] == node_address)		/* Neighbour routes through us, its cost must not come back to us */
+		{
+			printf("\nRoute leads back through this mote, ignored.\n");
+			return;
+		}
 
 		local_cost = (MAX_RSSI - (RSSI_array[(from->u8[1])-1])) + (100 - receive_message.battery);		/* Formula to calculate the cost, minimum cost means better route */
 
@@ -168,7 +529,8 @@ static void broadcast_recv(struct broadcast_conn *c, const linkaddr_t *from)
 		{
 			lut.next_hop.u8[1] = from->u8[1];					/* Updating next hop */
 			lut.cost = total_cost;								/* Updating cost */
-			printf("\n\n\nCost updated to: %d,\tNext hop updated to: 0x%x%x", lut.cost, lut.next_hop.u8[0], lut.next_hop.u8[1]);
+			lut.sink = receive_message.sink;					/* Cheapest gateway wins, whichever it is */
+			printf("\n\n\nCost updated to: %d,\tNext hop updated to: 0x%x%x,\tSink: 0x%x", lut.cost, lut.next_hop.u8[0], lut.next_hop.u8[1], lut.sink);
 			//leds_on(LEDS_YELLOW);
 			//ctimer_set(&ctimer_LUT_update_LED, CLOCK_SECOND, callback_off, NULL);
 		}
@@ -178,7 +540,8 @@ static void broadcast_recv(struct broadcast_conn *c, const linkaddr_t *from)
 			if(lut.next_hop.u8[1] == from->u8[1])				/* If received from the mote which was the next hop, cost must still be updated */
 			{
 				lut.cost = total_cost;
-				printf("\nCost Updated.\n");
+				lut.sink = receive_message.sink;
+					printf("\nCost Updated.\n");
 			}
 			printf("\nNext Hop not updated.\n");
 		}
@@ -197,19 +560,30 @@ AUTOSTART_PROCESSES(&code_for_field_motes);
 
 PROCESS_THREAD(code_for_field_motes, ev, data) {
 
-	PROCESS_EXITHANDLER(broadcast_close(&broadcastConn); unicast_close(&unicast))
+	PROCESS_EXITHANDLER(broadcast_close(&broadcastConn); unicast_close(&unicast); broadcast_close(&captureConn); unicast_close(&bulk))
 	PROCESS_BEGIN();
 
 	NETSTACK_CONF_RADIO.set_value(RADIO_PARAM_CHANNEL,  CHANNEL);
 	NETSTACK_CONF_RADIO.set_value(RADIO_PARAM_TXPOWER, TX_POWER);
 
+#ifndef CONTIKI_TARGET_COOJA
 	button_sensor.configure(BUTTON_SENSOR_CONFIG_TYPE_INTERVAL, CLOCK_SECOND/2);
 	adc_zoul.configure(SENSORS_HW_INIT, ZOUL_SENSORS_ADC1);
+#endif
 
 	unicast_open(&unicast, 129, &unicast_call);
 	broadcast_open(&broadcastConn, 125, &broadcast_callbacks);
+	broadcast_open(&captureConn, 127, &capture_callbacks);
+	unicast_open(&bulk, 131, &bulk_call);
 
-	ctimer_set(&timer_broadcast, CLOCK_SECOND*10+ 0.1*random_rand()/RANDOM_RAND_MAX, callback_broadcast, NULL);
+	if(MULTI_CHANNEL)
+	{
+		ctimer_set(&timer_rendezvous, 1, callback_rendezvous, NULL);		/* Beacons are sent from the rendezvous window */
+	}
+	else
+	{
+		ctimer_set(&timer_broadcast, CLOCK_SECOND*10+ 0.1*random_rand()/RANDOM_RAND_MAX, callback_broadcast, NULL);
+	}
 	ctimer_set(&timer_sensor, CLOCK_SECOND*5+ 0.1*random_rand()/RANDOM_RAND_MAX, callback_sensor, NULL);
 	ctimer_set(&timer_LUT_reset, CLOCK_SECOND*120, callback_LUT_reset, NULL);
 
@@ -223,7 +597,7 @@ PROCESS_THREAD(code_for_field_motes, ev, data) {
 	    {
 	    	if(data == &button_sensor)	 /* Event from the User button */
 	    	{
-	    		if(button_sensor.value(BUTTON_SENSOR_VALUE_TYPE_LEVEL) == BUTTON_SENSOR_PRESSED_LEVEL)	/* Button was pressed */
+	    		if(BUTTON_PRESSED())	/* Button was pressed */
 	    		{
 	    			if(flag == false)
 	    			{
@@ -242,6 +616,11 @@ PROCESS_THREAD(code_for_field_motes, ev, data) {
 	    		}
 	    	}
 	    }
+
+		else if(ev == serial_line_event_message && strcmp((const char *)data, TRAIN_PASS_LINE) == 0)
+		{
+			report_vibration(2000);			/* Same path as a real detection, for simulations and bench tests */
+		}
 	}
 
 	PROCESS_END();
@@ -253,7 +632,7 @@ static void callback_broadcast(void *ptr)	/* Periodic broadcasting LUT */
 {
 	if(flag1 == false)			/* Programming logic to simulate change in route due to low battery */
 	{
-		lut.battery= (vdd3_sensor.value(CC2538_SENSORS_VALUE_TYPE_CONVERTED))/40;
+		lut.battery = BATTERY_VALUE();
 	}
 
 	else if (flag1 == true && flag == true)
@@ -263,37 +642,235 @@ static void callback_broadcast(void *ptr)	/* Periodic broadcasting LUT */
 
 	else if (flag1 == true && flag == false)
 	{
-		lut.battery= (vdd3_sensor.value(CC2538_SENSORS_VALUE_TYPE_CONVERTED))/40;
+		lut.battery = BATTERY_VALUE();
+	}
+
+	if(slot_synced && ++epoch_age > EPOCH_MAX_AGE)			/* Nobody closer to the epoch sink is left, e.g. it was switched off */
+	{
+		printf("\nEpoch of gateway 0x%x lost.\n", lut.epoch_sink);
+		lut.epoch_sink = lut.epoch_hops = EPOCH_NONE;
+		slot_synced = false;
 	}
 
+	lut.sink_clock = (uint32_t)clock_time() + sink_clock_offset;
 	packetbuf_copyfrom(&lut, sizeof(l_table));
 	broadcast_send(&broadcastConn);
 
-	printf("\n\nLUT broadcasted: \nNext Hop: 0x%x%x\nCost: %d\nBattery: %d.\n",lut.next_hop.u8[0],lut.next_hop.u8[1],lut.cost, lut.battery);
+	printf("\n\nLUT broadcasted: \nNext Hop: 0x%x%x\nCost: %d\nBattery: %d\nSink: 0x%x.\n",lut.next_hop.u8[0],lut.next_hop.u8[1],lut.cost, lut.battery, lut.sink);
 
-	ctimer_reset(&timer_broadcast);
+	if(!MULTI_CHANNEL)
+	{
+		ctimer_reset(&timer_broadcast);
+	}
 }
 
 /*--------------------------------------------------------------------------------_*/
 static void callback_sensor(void *ptr)			/* Periodic sensing of vibrations */
 {
 	uint16_t adc1_value;
-	adc1_value = adc_zoul.value(ZOUL_SENSORS_ADC1) >> 4;
+	adc1_value = ADC1_VALUE();
 
 	if(adc1_value >1800 || adc1_value< 500 )
 	{
-		tx_packet.source_id = (linkaddr_node_addr.u8[1] & 0xFF);
-		tx_packet.vibration_value  = adc1_value;
+		report_vibration(adc1_value);
+	}
+
+	ctimer_reset(&timer_sensor);
+}
+
+/*--------------------------------------------------------------------------------_*/
+static void report_vibration(uint16_t value)	/* Reports a vibration sampled just now, at once or in the slot of this mote */
+{
+	sample_time = clock_time();
+	tx_packet.source_id = (linkaddr_node_addr.u8[1] & 0xFF);
+	tx_packet.vibration_value  = value;
+	tx_packet.hop_count = 0;
+	tx_packet.queue_delay = 0;
+
+	printf("\nVibration detected, value: %d.\n",tx_packet.vibration_value);
+
+	if(SLOTTED_REPORTS && slot_synced)
+	{
+		ctimer_set(&timer_slot, slot_delay(), callback_slot_send, NULL);
+	}
+	else
+	{
+		callback_slot_send(NULL);			/* Contention, or no epoch learned yet */
+	}
+
+	leds_on(LEDS_BLUE);
+	ctimer_set(&ctimer_vibration_detected_LED, CLOCK_SECOND*tx_packet.source_id, callback_off, NULL);
+}
+
+/*--------------------------------------------------------------------------------_*/
+static clock_time_t slot_delay(void)			/* Ticks until the send offset of this mote in the slot frame */
+{
+	uint16_t phase = ((uint32_t)clock_time() + sink_clock_offset) % SLOT_FRAME_TICKS;
+	uint16_t lag = lut.epoch_hops * SLOT_HOP_LAG;			/* The epoch lags the sink by about one beacon delay per hop */
+	uint16_t offset;
+
+	if(lag > SLOT_FRAME_TICKS / 2)
+		lag = SLOT_FRAME_TICKS / 2;
+
+	/* Slot by position along the line, so motes within radio reach never share one */
+	offset = ((node_address % SLOT_FRAME_SLOTS) * SLOT_TICKS + SLOT_GUARD_TICKS + SLOT_FRAME_TICKS - lag) % SLOT_FRAME_TICKS;
 
-		printf("\nVibration detected, value: %d.\n",tx_packet.vibration_value);
+	return (offset + SLOT_FRAME_TICKS - phase) % SLOT_FRAME_TICKS;
+}
+
+/*--------------------------------------------------------------------------------_*/
+static void callback_slot_send(void *ptr)		/* Sends the report waiting in tx_packet */
+{
+	tx_packet.origin_delay = (uint16_t)(clock_time() - sample_time) + mac_delay;	/* Slot wait plus the time the MAC takes to get it out */
+
+	packetbuf_copyfrom(&tx_packet, sizeof(packet_t));
+	route_send(&unicast);
+	last_report_time = clock_time();
+}
+
+/*--------------------------------------------------------------------------------_*/
+static void callback_capture_sample(void *ptr)		/* Records one raw sample per tick into the capture buffer */
+{
+	capture_buffer[capture_length++] = ADC1_VALUE();
 
-		packetbuf_copyfrom(&tx_packet, sizeof(packet_t));
-		unicast_send(&unicast, &lut.next_hop);
-		leds_on(LEDS_BLUE);
-		ctimer_set(&ctimer_vibration_detected_LED, CLOCK_SECOND*tx_packet.source_id, callback_off, NULL);
+	if(capture_length < CAPTURE_SAMPLES)
+	{
+		ctimer_reset(&timer_capture);
+		return;
 	}
 
-	ctimer_reset(&timer_sensor);
+	printf("\nWaveform capture %d recorded, sending.\n", capture_transfer_id);
+	capture_pending = CAPTURE_ALL_CHUNKS;
+	capture_state = CAPTURE_SENDING;
+	ctimer_set(&timer_capture, CAPTURE_CHUNK_INTERVAL, callback_capture_chunk, NULL);
+}
+
+/*--------------------------------------------------------------------------------_*/
+static void capture_encode(uint8_t index, capture_chunk_t *chunk)	/* Delta compression of one chunk */
+{
+	const uint16_t *sample = &capture_buffer[index * CAPTURE_CHUNK_SAMPLES];
+	uint8_t len = 0;
+
+	chunk->source_id = node_address;
+	chunk->transfer_id = capture_transfer_id;
+	chunk->index = index;
+
+	chunk->data[len++] = sample[0] & 0xFF;
+	chunk->data[len++] = sample[0] >> 8;
+
+	for(int i = 1; i < CAPTURE_CHUNK_SAMPLES; i++)
+	{
+		int16_t delta = (int16_t)(sample[i] - sample[i-1]);
+
+		if(delta > -128 && delta < 128)
+		{
+			chunk->data[len++] = (uint8_t)delta;
+		}
+		else
+		{
+			chunk->data[len++] = (uint8_t)CAPTURE_DELTA_ESCAPE;
+			chunk->data[len++] = sample[i] & 0xFF;
+			chunk->data[len++] = sample[i] >> 8;
+		}
+	}
+
+	chunk->length = len;
+}
+
+/*--------------------------------------------------------------------------------_*/
+static void callback_capture_chunk(void *ptr)		/* Sends the next missing chunk, at most one per CAPTURE_CHUNK_INTERVAL */
+{
+	capture_chunk_t chunk;
+	uint8_t index = 0;
+
+	if(clock_time() - last_report_time < CAPTURE_YIELD_TICKS)		/* Vibration reports have priority */
+	{
+		ctimer_reset(&timer_capture);
+		return;
+	}
+
+	if(capture_pending == 0)
+	{
+		capture_state = CAPTURE_DONE;
+		return;
+	}
+
+	while(!(capture_pending & (1U << index)))
+	{
+		index++;
+	}
+
+	capture_encode(index, &chunk);
+	packetbuf_copyfrom(&chunk, sizeof(capture_chunk_t) - CAPTURE_CHUNK_BYTES + chunk.length);
+	route_send(&bulk);
+	capture_pending &= ~(1U << index);
+
+	if(capture_pending != 0)
+	{
+		ctimer_reset(&timer_capture);
+	}
+	else
+	{
+		capture_state = CAPTURE_DONE;					/* Kept until the gateway ends the transfer, it may ask for chunks again */
+	}
+}
+
+/*--------------------------------------------------------------------------------_*/
+static void callback_relay(void *ptr)				/* Forwards the oldest held chunk once no report was sent or forwarded for a while */
+{
+	clock_time_t since_report = clock_time() - last_report_time;
+
+	if(since_report < CAPTURE_YIELD_TICKS)
+	{
+		ctimer_set(&timer_relay, CAPTURE_YIELD_TICKS - since_report, callback_relay, NULL);
+		return;
+	}
+
+	packetbuf_copyfrom(&relay_chunk[relay_head], relay_length[relay_head]);
+	route_send(&bulk);
+	relay_head = (relay_head + 1) % CAPTURE_RELAY_SLOTS;
+	relay_count--;
+
+	if(relay_count > 0)
+	{
+		ctimer_set(&timer_relay, CAPTURE_CHUNK_INTERVAL / 2, callback_relay, NULL);
+	}
+}
+
+/*--------------------------------------------------------------------------------_*/
+static void callback_flood(void *ptr)				/* Rebroadcast of a capture command for motes further away */
+{
+	clock_time_t wait = rendezvous_wait();
+
+	if(wait > 0)
+	{
+		ctimer_set(&timer_flood, wait, callback_flood, NULL);
+		return;
+	}
+
+	packetbuf_copyfrom(&flood_cmd, sizeof(capture_cmd_t));
+	broadcast_send(&captureConn);
+}
+
+/*--------------------------------------------------------------------------------_*/
+static void callback_rendezvous(void *ptr)			/* Runs at the start and at the end of every rendezvous window */
+{
+	uint16_t phase = rendezvous_phase();
+
+	if(phase < MC_RENDEZVOUS_TICKS)
+	{
+		if(phase < MC_RENDEZVOUS_TICKS / 4)			/* Window just opened: beacon within its first half */
+		{
+			ctimer_set(&timer_broadcast, 1 + random_rand() % (MC_RENDEZVOUS_TICKS / 4), callback_broadcast, NULL);
+		}
+		ctimer_set(&timer_rendezvous, MC_RENDEZVOUS_TICKS - phase, callback_rendezvous, NULL);
+	}
+	else
+	{
+		ctimer_set(&timer_rendezvous, MC_RENDEZVOUS_PERIOD - phase, callback_rendezvous, NULL);
+	}
+
+	radio_channel_update();
 }
 
 /*--------------------------------------------------------------------------------_*/
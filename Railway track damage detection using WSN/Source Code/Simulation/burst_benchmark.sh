@@ -0,0 +1,38 @@
+#!/bin/bash
+#
+#   Wireless Sensor Networks Laboratory
+#
+#   Technische Universitaet Muenchen
+#   Lehrstuhl fuer Kommunikationsnetze
+#   http://www.lkn.ei.tum.de
+#
+#   This program is free software: you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation, version 2.0 of the License.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+#   SLOTTED REPORTING BENCHMARK: the six-mote line with every mote sensing the same train
+#
+#   All five field motes report at the same instant, which is the burst the slots are
+#   meant to spread. Per setting it prints how many "Report Source ID" lines the gateway
+#   printed per burst and the SUMMARY (delivery, completion time, MAC collisions).
+#
+#   Usage: burst_benchmark.sh [bursts] [seed]
+
+BURSTS="${1:-20}"
+SEED="${2:-123456}"
+HERE="$(cd "$(dirname "$0")" && pwd)"
+
+for SLOTTED in 0 1; do
+	echo "=== SLOTTED_REPORTS=$SLOTTED ==="
+	"$HERE/run_line.sh" -- --motes 6 --gateways 1 --defines "SLOTTED_REPORTS=$SLOTTED" \
+		--bursts "$BURSTS" --period 90 --warmup 180 --seed "$SEED" \
+		--label "SLOTTED_REPORTS=$SLOTTED" || exit 1
+done
@@ -0,0 +1,48 @@
+#!/bin/bash
+#
+#   Wireless Sensor Networks Laboratory
+#
+#   Technische Universitaet Muenchen
+#   Lehrstuhl fuer Kommunikationsnetze
+#   http://www.lkn.ei.tum.de
+#
+#   This program is free software: you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation, version 2.0 of the License.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+#   MULTI-CHANNEL BENCHMARK: a long line with a gateway at each end under back-to-back trains
+#
+#   Twenty motes, gateways 1 and 20, so reports from the middle cross up to nine hops
+#   and the hop groups of both trees reuse every data channel. A train passes every
+#   40 s, so the channel carries a burst of 18 reports and their relays far more often
+#   than real trains would.
+#
+#   Deliveries are counted per received unicast (--count packet). The gateways' own
+#   "Report Source ID" lines come once per mote and 60 s evaluation window, so at this
+#   rate most bursts would fall into the previous burst's window and not be seen.
+#
+#   Per setting the SUMMARY line gives throughput (reports/s reaching a gateway, over
+#   the run and while a burst is in flight), delivery, transmissions per unicast and
+#   the share of unicasts csma gave up on after a collision or for lack of an ack.
+#
+#   Usage: channel_benchmark.sh [bursts] [seed] [extra DEFINES, e.g. SLOTTED_REPORTS=1]
+
+BURSTS="${1:-30}"
+SEED="${2:-123456}"
+EXTRA="${3:+,$3}"
+HERE="$(cd "$(dirname "$0")" && pwd)"
+
+for MC in 0 1; do
+	echo "=== MULTI_CHANNEL=$MC ==="
+	"$HERE/run_line.sh" -- --motes 20 --gateways 1,20 --defines "MULTI_CHANNEL=$MC$EXTRA" \
+		--bursts "$BURSTS" --period 40 --warmup 300 --count packet --seed "$SEED" \
+		--label "MULTI_CHANNEL=$MC$EXTRA" || exit 1
+done
@@ -0,0 +1,259 @@
+<?xml version="1.0" encoding="UTF-8"?>
+<simconf>
+  <simulation>
+    <title>Railway line: six-mote line</title>
+    <randomseed>123456</randomseed>
+    <motedelay_us>1000000</motedelay_us>
+    <radiomedium>
+      org.contikios.cooja.radiomediums.UDGM
+      <transmitting_range>25.0</transmitting_range>
+      <interference_range>50.0</interference_range>
+      <success_ratio_tx>1.0</success_ratio_tx>
+      <success_ratio_rx>1.0</success_ratio_rx>
+    </radiomedium>
+    <events>
+      <logoutput>40000</logoutput>
+    </events>
+    <motetype>
+      org.contikios.cooja.contikimote.ContikiMoteType
+      <identifier>gateway</identifier>
+      <description>Gateway</description>
+      <source EXPORT="discard">[CONFIG_DIR]/../Gateway Code/L3_Gateway/gateway.c</source>
+      <commands EXPORT="discard">make clean TARGET=cooja
+make gateway.cooja TARGET=cooja</commands>
+      <moteinterface>org.contikios.cooja.interfaces.Position</moteinterface>
+      <moteinterface>org.contikios.cooja.interfaces.Battery</moteinterface>
+      <moteinterface>org.contikios.cooja.contikimote.interfaces.ContikiVib</moteinterface>
+      <moteinterface>org.contikios.cooja.contikimote.interfaces.ContikiMoteID</moteinterface>
+      <moteinterface>org.contikios.cooja.contikimote.interfaces.ContikiRS232</moteinterface>
+      <moteinterface>org.contikios.cooja.contikimote.interfaces.ContikiBeeper</moteinterface>
+      <moteinterface>org.contikios.cooja.interfaces.RimeAddress</moteinterface>
+      <moteinterface>org.contikios.cooja.contikimote.interfaces.ContikiIPAddress</moteinterface>
+      <moteinterface>org.contikios.cooja.contikimote.interfaces.ContikiRadio</moteinterface>
+      <moteinterface>org.contikios.cooja.contikimote.interfaces.ContikiButton</moteinterface>
+      <moteinterface>org.contikios.cooja.contikimote.interfaces.ContikiPIR</moteinterface>
+      <moteinterface>org.contikios.cooja.contikimote.interfaces.ContikiClock</moteinterface>
+      <moteinterface>org.contikios.cooja.contikimote.interfaces.ContikiLED</moteinterface>
+      <moteinterface>org.contikios.cooja.contikimote.interfaces.ContikiCFS</moteinterface>
+      <moteinterface>org.contikios.cooja.contikimote.interfaces.ContikiEEPROM</moteinterface>
+      <moteinterface>org.contikios.cooja.interfaces.Mote2MoteRelations</moteinterface>
+      <moteinterface>org.contikios.cooja.interfaces.MoteAttributes</moteinterface>
+      <symbols>false</symbols>
+    </motetype>
+    <motetype>
+      org.contikios.cooja.contikimote.ContikiMoteType
+      <identifier>routing</identifier>
+      <description>Field mote</description>
+      <source EXPORT="discard">[CONFIG_DIR]/../Routing Code/L5_Routing/routing.c</source>
+      <commands EXPORT="discard">make clean TARGET=cooja
+make routing.cooja TARGET=cooja</commands>
+      <moteinterface>org.contikios.cooja.interfaces.Position</moteinterface>
+      <moteinterface>org.contikios.cooja.interfaces.Battery</moteinterface>
+      <moteinterface>org.contikios.cooja.contikimote.interfaces.ContikiVib</moteinterface>
+      <moteinterface>org.contikios.cooja.contikimote.interfaces.ContikiMoteID</moteinterface>
+      <moteinterface>org.contikios.cooja.contikimote.interfaces.ContikiRS232</moteinterface>
+      <moteinterface>org.contikios.cooja.contikimote.interfaces.ContikiBeeper</moteinterface>
+      <moteinterface>org.contikios.cooja.interfaces.RimeAddress</moteinterface>
+      <moteinterface>org.contikios.cooja.contikimote.interfaces.ContikiIPAddress</moteinterface>
+      <moteinterface>org.contikios.cooja.contikimote.interfaces.ContikiRadio</moteinterface>
+      <moteinterface>org.contikios.cooja.contikimote.interfaces.ContikiButton</moteinterface>
+      <moteinterface>org.contikios.cooja.contikimote.interfaces.ContikiPIR</moteinterface>
+      <moteinterface>org.contikios.cooja.contikimote.interfaces.ContikiClock</moteinterface>
+      <moteinterface>org.contikios.cooja.contikimote.interfaces.ContikiLED</moteinterface>
+      <moteinterface>org.contikios.cooja.contikimote.interfaces.ContikiCFS</moteinterface>
+      <moteinterface>org.contikios.cooja.contikimote.interfaces.ContikiEEPROM</moteinterface>
+      <moteinterface>org.contikios.cooja.interfaces.Mote2MoteRelations</moteinterface>
+      <moteinterface>org.contikios.cooja.interfaces.MoteAttributes</moteinterface>
+      <symbols>false</symbols>
+    </motetype>
+    <mote>
+      <interface_config>
+        org.contikios.cooja.interfaces.Position
+        <x>0.0</x>
+        <y>0.0</y>
+        <z>0.0</z>
+      </interface_config>
+      <interface_config>
+        org.contikios.cooja.contikimote.interfaces.ContikiMoteID
+        <id>1</id>
+      </interface_config>
+      <motetype_identifier>gateway</motetype_identifier>
+    </mote>
+    <mote>
+      <interface_config>
+        org.contikios.cooja.interfaces.Position
+        <x>10.0</x>
+        <y>0.0</y>
+        <z>0.0</z>
+      </interface_config>
+      <interface_config>
+        org.contikios.cooja.contikimote.interfaces.ContikiMoteID
+        <id>2</id>
+      </interface_config>
+      <motetype_identifier>routing</motetype_identifier>
+    </mote>
+    <mote>
+      <interface_config>
+        org.contikios.cooja.interfaces.Position
+        <x>20.0</x>
+        <y>0.0</y>
+        <z>0.0</z>
+      </interface_config>
+      <interface_config>
+        org.contikios.cooja.contikimote.interfaces.ContikiMoteID
+        <id>3</id>
+      </interface_config>
+      <motetype_identifier>routing</motetype_identifier>
+    </mote>
+    <mote>
+      <interface_config>
+        org.contikios.cooja.interfaces.Position
+        <x>30.0</x>
+        <y>0.0</y>
+        <z>0.0</z>
+      </interface_config>
+      <interface_config>
+        org.contikios.cooja.contikimote.interfaces.ContikiMoteID
+        <id>4</id>
+      </interface_config>
+      <motetype_identifier>routing</motetype_identifier>
+    </mote>
+    <mote>
+      <interface_config>
+        org.contikios.cooja.interfaces.Position
+        <x>40.0</x>
+        <y>0.0</y>
+        <z>0.0</z>
+      </interface_config>
+      <interface_config>
+        org.contikios.cooja.contikimote.interfaces.ContikiMoteID
+        <id>5</id>
+      </interface_config>
+      <motetype_identifier>routing</motetype_identifier>
+    </mote>
+    <mote>
+      <interface_config>
+        org.contikios.cooja.interfaces.Position
+        <x>50.0</x>
+        <y>0.0</y>
+        <z>0.0</z>
+      </interface_config>
+      <interface_config>
+        org.contikios.cooja.contikimote.interfaces.ContikiMoteID
+        <id>6</id>
+      </interface_config>
+      <motetype_identifier>routing</motetype_identifier>
+    </mote>
+  </simulation>
+  <plugin>
+    org.contikios.cooja.plugins.ScriptRunner
+    <plugin_config>
+      <script>/* Train pass bursts, see make_line_csc.py */
+TIMEOUT(2070000);
+
+var GATEWAYS = [1];
+var BURSTS = 20;
+var PERIOD = 90000;                    /* ms */
+var WARMUP = 180000;                    /* ms */
+var LABEL = "six-mote line";
+var DELIVERY = /Report Source ID = (\d+)/;
+
+var motes = sim.getMotes();
+var expected = motes.length - GATEWAYS.length;
+var burst = -1, start = 0, last = 0, seen = {}, count = 0;
+var delivered = 0, ratio_sum = 0, completion = [], busy = 0;
+var sends = 0, transmissions = 0, collisions = 0, noacks = 0;
+
+function is_gateway(mote_id)
+{
+    for (var i = 0; i &lt; GATEWAYS.length; i++)
+        if (GATEWAYS[i] == mote_id)
+            return true;
+    return false;
+}
+
+function percentile(values, p)
+{
+    if (values.length == 0)
+        return 0;
+    var sorted = values.slice().sort(function(a, b) { return a - b; });
+    return sorted[Math.floor((sorted.length - 1) * p / 100)];
+}
+
+function close_burst()
+{
+    ratio_sum += count / expected;
+    if (count &gt; 0)
+    {
+        completion.push((last - start) / 1000);
+        busy += (last - start) / 1000;
+    }
+    log.log("burst " + burst + ": " + count + "/" + expected + " sources, last after " +
+            (count &gt; 0 ? (last - start) / 1000 : "-") + " ms\n");
+}
+
+GENERATE_MSG(WARMUP, "burst");
+
+while (true)
+{
+    YIELD();
+    var line = String(msg);
+
+    if (line == "burst")
+    {
+        if (burst &gt;= 0)
+            close_burst();
+        if (burst + 1 == BURSTS)
+            break;
+        burst++;
+        start = time;
+        count = 0;
+        seen = {};
+        for (var i = 0; i &lt; motes.length; i++)
+            write(motes[i], "Train Pass\n");
+        GENERATE_MSG(PERIOD, "burst");
+        continue;
+    }
+
+    if (burst &lt; 0)
+        continue;
+
+    var report = line.match(DELIVERY);
+    if (report &amp;&amp; is_gateway(id) &amp;&amp; !is_gateway(parseInt(report[1])) &amp;&amp; !seen[report[1]])
+    {
+        seen[report[1]] = true;
+        count++;
+        delivered++;
+        last = time;
+    }
+
+    var sent = line.match(/MAC sent: status (\d+), transmissions (\d+)/);
+    if (sent)
+    {
+        sends++;
+        transmissions += parseInt(sent[2]);
+        if (sent[1] == "1")
+            collisions++;
+        else if (sent[1] == "2")
+            noacks++;
+    }
+}
+
+log.log("SUMMARY " + LABEL + ": delivery " + (100 * ratio_sum / BURSTS).toFixed(1) + "%" +
+        ", completion p50 " + percentile(completion, 50).toFixed(0) + " ms p95 " + percentile(completion, 95).toFixed(0) + " ms" +
+        ", throughput " + (delivered * 1000 / (BURSTS * PERIOD)).toFixed(3) + " reports/s" +
+        " (" + (busy ? delivered * 1000 / busy : 0).toFixed(2) + " while a burst is in flight)" +
+        ", unicasts " + sends + ", transmissions/unicast " + (sends ? transmissions / sends : 0).toFixed(2) +
+        ", collision " + (sends ? 100 * collisions / sends : 0).toFixed(1) + "%" +
+        ", no ack " + (sends ? 100 * noacks / sends : 0).toFixed(1) + "%\n");
+log.testOK();
+</script>
+      <active>true</active>
+    </plugin_config>
+    <width>600</width>
+    <z>0</z>
+    <height>700</height>
+    <location_x>0</location_x>
+    <location_y>0</location_y>
+  </plugin>
+</simconf>
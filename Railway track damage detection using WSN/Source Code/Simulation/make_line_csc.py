@@ -0,0 +1,287 @@
+#!/usr/bin/env python3
+#
+#   Wireless Sensor Networks Laboratory
+#
+#   Technische Universitaet Muenchen
+#   Lehrstuhl fuer Kommunikationsnetze
+#   http://www.lkn.ei.tum.de
+#
+#   This program is free software: you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation, version 2.0 of the License.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+#   COOJA LINE SIMULATION: writes a .csc with motes on a straight line
+#
+#   Usage: make_line_csc.py [--motes 6] [--gateways 1] [--defines SLOTTED_REPORTS=1]
+#                           [--bursts 20] [--period 90] [--warmup 180] [--count report] > line.csc
+#
+#   Mote IDs 1..motes sit --spacing metres apart, so with the default radio range each
+#   one reaches two neighbours on either side, like the emulated reach in routing.c.
+#   The motes run routing.c, the gateways gateway.c, both built as Cooja motes with
+#   --defines passed to Contiki as DEFINES (MAX_NO_OF_MOTES is added automatically).
+#
+#   The embedded script injects a train pass (TRAIN_PASS_LINE) into every mote at the
+#   same instant every --period seconds, after --warmup seconds for routes and epoch.
+#   Per burst it counts the distinct field motes whose report reached a gateway, and
+#   how long the last one took. At the end it logs one line starting with SUMMARY,
+#   with delivery, completion time, throughput over the run and over the time from
+#   each burst to its last delivery, and the MAC outcome of all unicasts ("MAC sent"
+#   lines), then stops the simulation.
+#
+#   --count report counts the gateway's "Report Source ID" lines. The gateway prints
+#   one per mote and window, and a window only closes at its 60 s evaluation once no
+#   report came for PASS_QUIET_TICKS (20 s), so bursts must be more than 80 s apart
+#   or a burst lands in the previous one's window and is not seen at all.
+#   --count packet counts every "Unicast message received" line of a gateway instead,
+#   which does not depend on the windows and allows bursts at any rate.
+
+import argparse
+import sys
+from xml.sax.saxutils import escape
+
+MOTE_INTERFACES = [
+    "org.contikios.cooja.interfaces.Position",
+    "org.contikios.cooja.interfaces.Battery",
+    "org.contikios.cooja.contikimote.interfaces.ContikiVib",
+    "org.contikios.cooja.contikimote.interfaces.ContikiMoteID",
+    "org.contikios.cooja.contikimote.interfaces.ContikiRS232",
+    "org.contikios.cooja.contikimote.interfaces.ContikiBeeper",
+    "org.contikios.cooja.interfaces.RimeAddress",
+    "org.contikios.cooja.contikimote.interfaces.ContikiIPAddress",
+    "org.contikios.cooja.contikimote.interfaces.ContikiRadio",
+    "org.contikios.cooja.contikimote.interfaces.ContikiButton",
+    "org.contikios.cooja.contikimote.interfaces.ContikiPIR",
+    "org.contikios.cooja.contikimote.interfaces.ContikiClock",
+    "org.contikios.cooja.contikimote.interfaces.ContikiLED",
+    "org.contikios.cooja.contikimote.interfaces.ContikiCFS",
+    "org.contikios.cooja.contikimote.interfaces.ContikiEEPROM",
+    "org.contikios.cooja.interfaces.Mote2MoteRelations",
+    "org.contikios.cooja.interfaces.MoteAttributes",
+]
+
+SCRIPT = """/* Train pass bursts, see make_line_csc.py */
+TIMEOUT(%(timeout)d);
+
+var GATEWAYS = [%(gateways)s];
+var BURSTS = %(bursts)d;
+var PERIOD = %(period)d;                    /* ms */
+var WARMUP = %(warmup)d;                    /* ms */
+var LABEL = "%(label)s";
+var DELIVERY = %(delivery)s;
+
+var motes = sim.getMotes();
+var expected = motes.length - GATEWAYS.length;
+var burst = -1, start = 0, last = 0, seen = {}, count = 0;
+var delivered = 0, ratio_sum = 0, completion = [], busy = 0;
+var sends = 0, transmissions = 0, collisions = 0, noacks = 0;
+
+function is_gateway(mote_id)
+{
+    for (var i = 0; i < GATEWAYS.length; i++)
+        if (GATEWAYS[i] == mote_id)
+            return true;
+    return false;
+}
+
+function percentile(values, p)
+{
+    if (values.length == 0)
+        return 0;
+    var sorted = values.slice().sort(function(a, b) { return a - b; });
+    return sorted[Math.floor((sorted.length - 1) * p / 100)];
+}
+
+function close_burst()
+{
+    ratio_sum += count / expected;
+    if (count > 0)
+    {
+        completion.push((last - start) / 1000);
+        busy += (last - start) / 1000;
+    }
+    log.log("burst " + burst + ": " + count + "/" + expected + " sources, last after " +
+            (count > 0 ? (last - start) / 1000 : "-") + " ms\\n");
+}
+
+GENERATE_MSG(WARMUP, "burst");
+
+while (true)
+{
+    YIELD();
+    var line = String(msg);
+
+    if (line == "burst")
+    {
+        if (burst >= 0)
+            close_burst();
+        if (burst + 1 == BURSTS)
+            break;
+        burst++;
+        start = time;
+        count = 0;
+        seen = {};
+        for (var i = 0; i < motes.length; i++)
+            write(motes[i], "Train Pass\\n");
+        GENERATE_MSG(PERIOD, "burst");
+        continue;
+    }
+
+    if (burst < 0)
+        continue;
+
+    var report = line.match(DELIVERY);
+    if (report && is_gateway(id) && !is_gateway(parseInt(report[1])) && !seen[report[1]])
+    {
+        seen[report[1]] = true;
+        count++;
+        delivered++;
+        last = time;
+    }
+
+    var sent = line.match(/MAC sent: status (\\d+), transmissions (\\d+)/);
+    if (sent)
+    {
+        sends++;
+        transmissions += parseInt(sent[2]);
+        if (sent[1] == "1")
+            collisions++;
+        else if (sent[1] == "2")
+            noacks++;
+    }
+}
+
+log.log("SUMMARY " + LABEL + ": delivery " + (100 * ratio_sum / BURSTS).toFixed(1) + "%%" +
+        ", completion p50 " + percentile(completion, 50).toFixed(0) + " ms p95 " + percentile(completion, 95).toFixed(0) + " ms" +
+        ", throughput " + (delivered * 1000 / (BURSTS * PERIOD)).toFixed(3) + " reports/s" +
+        " (" + (busy ? delivered * 1000 / busy : 0).toFixed(2) + " while a burst is in flight)" +
+        ", unicasts " + sends + ", transmissions/unicast " + (sends ? transmissions / sends : 0).toFixed(2) +
+        ", collision " + (sends ? 100 * collisions / sends : 0).toFixed(1) + "%%" +
+        ", no ack " + (sends ? 100 * noacks / sends : 0).toFixed(1) + "%%\\n");
+log.testOK();
+"""
+
+
+def mote_type(identifier, description, source, target, defines):
+    make = "make %s.cooja TARGET=cooja" % target
+    if defines:
+        make += " DEFINES=" + ",".join(defines)
+    lines = [
+        "    <motetype>",
+        "      org.contikios.cooja.contikimote.ContikiMoteType",
+        "      <identifier>%s</identifier>" % identifier,
+        "      <description>%s</description>" % description,
+        "      <source EXPORT=\"discard\">%s</source>" % escape(source),
+        # Objects do not depend on DEFINES, so every variant starts from a clean build
+        "      <commands EXPORT=\"discard\">make clean TARGET=cooja\n%s</commands>" % escape(make),
+    ]
+    lines += ["      <moteinterface>%s</moteinterface>" % i for i in MOTE_INTERFACES]
+    lines += ["      <symbols>false</symbols>", "    </motetype>"]
+    return lines
+
+
+def mote(mote_id, x, identifier):
+    return [
+        "    <mote>",
+        "      <interface_config>",
+        "        org.contikios.cooja.interfaces.Position",
+        "        <x>%.1f</x>" % x,
+        "        <y>0.0</y>",
+        "        <z>0.0</z>",
+        "      </interface_config>",
+        "      <interface_config>",
+        "        org.contikios.cooja.contikimote.interfaces.ContikiMoteID",
+        "        <id>%d</id>" % mote_id,
+        "      </interface_config>",
+        "      <motetype_identifier>%s</motetype_identifier>" % identifier,
+        "    </mote>",
+    ]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Cooja simulation of motes on a line with train pass bursts")
+    parser.add_argument("--motes", type=int, default=6, help="mote IDs 1..motes, gateways included")
+    parser.add_argument("--gateways", default="1", help="comma separated gateway IDs")
+    parser.add_argument("--defines", default="", help="comma separated Contiki DEFINES, e.g. SLOTTED_REPORTS=1")
+    parser.add_argument("--bursts", type=int, default=20)
+    parser.add_argument("--period", type=float, default=90, help="seconds between bursts")
+    parser.add_argument("--warmup", type=float, default=180, help="seconds before the first burst")
+    parser.add_argument("--spacing", type=float, default=10, help="metres between neighbouring motes")
+    parser.add_argument("--range", type=float, default=25, help="radio range in metres")
+    parser.add_argument("--seed", type=int, default=123456)
+    parser.add_argument("--count", choices=["report", "packet"], default="report",
+                        help="count 'Report Source ID' lines (one per window) or every received unicast")
+    parser.add_argument("--label", default=None, help="name in the SUMMARY line")
+    parser.add_argument("--root", default="[CONFIG_DIR]/..", help="directory containing 'Routing Code' and 'Gateway Code'")
+    args = parser.parse_args()
+
+    gateways = [int(g) for g in args.gateways.split(",") if g]
+    defines = [d for d in args.defines.split(",") if d]
+    if args.motes != 6:
+        defines.append("MAX_NO_OF_MOTES=%d" % args.motes)
+    if any(g < 1 or g > args.motes for g in gateways) or len(gateways) >= args.motes:
+        sys.exit("gateway IDs must be within 1..motes and leave at least one mote")
+    if args.count == "report" and args.period <= 60 + 20:
+        sys.exit("--count report needs bursts more than 80 s apart, the gateway prints one report line per mote and window")
+
+    label = args.label or "%d motes, gateways %s%s" % (args.motes, args.gateways, (", " + ",".join(defines)) if defines else "")
+    script = SCRIPT % {
+        "timeout": int((args.warmup + (args.bursts + 1) * args.period) * 1000),
+        "gateways": ", ".join(str(g) for g in gateways),
+        "bursts": args.bursts,
+        "period": int(args.period * 1000),
+        "warmup": int(args.warmup * 1000),
+        "label": label.replace('"', "'"),
+        "delivery": "/Report Source ID = (\\d+)/" if args.count == "report" else "/Unicast message received.*Source ID: '(\\d+)'/",
+    }
+
+    out = [
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>",
+        "<simconf>",
+        "  <simulation>",
+        "    <title>Railway line: %s</title>" % escape(label),
+        "    <randomseed>%d</randomseed>" % args.seed,
+        "    <motedelay_us>1000000</motedelay_us>",
+        "    <radiomedium>",
+        "      org.contikios.cooja.radiomediums.UDGM",
+        "      <transmitting_range>%.1f</transmitting_range>" % args.range,
+        "      <interference_range>%.1f</interference_range>" % (2 * args.range),
+        "      <success_ratio_tx>1.0</success_ratio_tx>",
+        "      <success_ratio_rx>1.0</success_ratio_rx>",
+        "    </radiomedium>",
+        "    <events>",
+        "      <logoutput>40000</logoutput>",
+        "    </events>",
+    ]
+    out += mote_type("gateway", "Gateway", args.root + "/Gateway Code/L3_Gateway/gateway.c", "gateway", defines)
+    out += mote_type("routing", "Field mote", args.root + "/Routing Code/L5_Routing/routing.c", "routing", defines)
+    for i in range(1, args.motes + 1):
+        out += mote(i, (i - 1) * args.spacing, "gateway" if i in gateways else "routing")
+    out += [
+        "  </simulation>",
+        "  <plugin>",
+        "    org.contikios.cooja.plugins.ScriptRunner",
+        "    <plugin_config>",
+        "      <script>%s</script>" % escape(script),
+        "      <active>true</active>",
+        "    </plugin_config>",
+        "    <width>600</width>",
+        "    <z>0</z>",
+        "    <height>700</height>",
+        "    <location_x>0</location_x>",
+        "    <location_y>0</location_y>",
+        "  </plugin>",
+        "</simconf>",
+    ]
+    print("\n".join(out))
+
+
+if __name__ == "__main__":
+    main()
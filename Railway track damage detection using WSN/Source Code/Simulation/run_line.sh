@@ -0,0 +1,62 @@
+#!/bin/bash
+#
+#   Wireless Sensor Networks Laboratory
+#
+#   Technische Universitaet Muenchen
+#   Lehrstuhl fuer Kommunikationsnetze
+#   http://www.lkn.ei.tum.de
+#
+#   This program is free software: you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation, version 2.0 of the License.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+#   Runs a line simulation headless and prints its per-burst counts and SUMMARY line
+#
+#   Usage: run_line.sh <file.csc>               a committed simulation, e.g. line6.csc
+#          run_line.sh -- <make_line_csc.py options>
+#
+#   CONTIKI defaults to $HOME/contiki like the mote Makefiles. The full Cooja log is
+#   kept in COOJA.testlog next to the printed path.
+
+set -e
+
+HERE="$(cd "$(dirname "$0")" && pwd)"
+CONTIKI="${CONTIKI:-$HOME/contiki}"
+COOJA="$CONTIKI/tools/cooja/dist/cooja.jar"
+
+if [ ! -f "$COOJA" ]; then
+	echo "Cooja not found at $COOJA, build it with 'ant jar' in $CONTIKI/tools/cooja" >&2
+	exit 1
+fi
+
+if [ "$1" = "--" ]; then
+	shift
+	CSC="$HERE/.line-$$.csc"
+	python3 "$HERE/make_line_csc.py" "$@" > "$CSC"
+	trap 'rm -f "$CSC"' EXIT
+elif [ -n "$1" ]; then
+	CSC="$(cd "$(dirname "$1")" && pwd)/$(basename "$1")"
+else
+	echo "Usage: $0 <file.csc> | -- <make_line_csc.py options>" >&2
+	exit 1
+fi
+
+# [CONFIG_DIR] is the directory of the .csc, so generated files are written next to the committed one
+RUN="$(mktemp -d /tmp/railway-cooja.XXXXXX)"
+cd "$RUN"
+java -mx512m -jar "$COOJA" -nogui="$CSC" -contiki="$CONTIKI" > cooja.out 2>&1 || true
+
+if ! grep -q "SUMMARY" COOJA.testlog 2>/dev/null; then
+	echo "Simulation did not finish, see $RUN/cooja.out" >&2
+	exit 1
+fi
+grep -E "burst [0-9]+:|SUMMARY" COOJA.testlog
+echo "Log: $RUN/COOJA.testlog"